@@ -2,11 +2,13 @@
 
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <string>
 #include <vector>
 namespace fs = std::filesystem;
 #include <cassert>
 #include <random>
+#include <thread>
 #include <unordered_map>
 
 
@@ -15,78 +17,216 @@ namespace fs = std::filesystem;
 #include <TGUI/Backend/SFML-Graphics.hpp>
 
 #include "mm.hpp"
+#include "physics.hpp"
+#include "physics_bin.hpp"
+#include "depth_order.hpp"
+#include "frame_profiler.hpp"
+#include "geometry_batch.hpp"
+#include "handles.hpp"
+#include "incremental_save.hpp"
+#include "journal.hpp"
+#include "label_atlas.hpp"
+#include "multilevel_layout.hpp"
+#include "packed_mm.hpp"
+#include "screen_grid.hpp"
+#include "screen_projection.hpp"
+#include "sim_thread.hpp"
 
 
 
 const sf::Font FONT("JetBrainsMonoNerdFont-Medium.ttf");
 const std::string BODY_GUI_PATH = "forms/body_editor.txt";
 const vec4 LABEL_OFFSET(0, 2, 0);
+const float NODE_RADIUS = 1.0f;
+const float LINE_THICKNESS = 1.0f;
+const unsigned LABEL_CHARACTER_SIZE = 30;
 
 const sf::Color HIGHLIGHT_COLOR = sf::Color::Blue;
 const sf::Color LINE_LABEL_COLOR = sf::Color(128, 128, 128);
 const sf::Color NEW_CONNECTION_COLOR = sf::Color::Green;
 
+// Threads for the physics step; 1 reproduces the single-threaded layout
+const size_t PHYSICS_THREADS = std::max(1u, std::thread::hardware_concurrency());
+
 struct Physical_MM {
     MM mm;
 
+    // Render-side objects only; positions live in sim and are copied in by
+    // update3DObjects
     struct Node {
-        vec4 position;
-        vec4 velocity;
         Sphere3D sphere;
         Label3D label;
 
-        Node() = default;
-        Node(vec4 position, vec4 velocity, Sphere3D sphere, std::string title)
-            : position(position),
-              velocity(velocity),
-              sphere(sphere),
+        Node(vec4 position, std::string title)
+            : sphere(position, NODE_RADIUS),
               label(position + LABEL_OFFSET, title, FONT) {}
-
-        bool operator==(const Node& other) const {
-            return position == other.position;
-        }
     };
-    std::unordered_map<std::string, std::unique_ptr<Node>> nodes;
 
-    std::vector<std::unique_ptr<Line3D>> lines;
+    /*
+    // ID system:
+    Nodes and connections live in dense arrays indexed by id, the same ids
+    the simulation uses:
+        node id: node_objects, id_to_title, sim nodes
+        connection index: lines, mm.connections, sim edges
+    Removing one moves the last into its place (swap-and-pop), so ids are
+    only good until the next removal. Anything that holds on to a node or a
+    connection (selection, hover, nodes) keeps a handle instead, which
+    node_table/edge_table turn into the current id in O(1).
+    */
+    struct NodeTag;
+    struct EdgeTag;
+    using NodeHandle = Handle<NodeTag>;
+    using EdgeHandle = Handle<EdgeTag>;
+
+    HandleTable<NodeTag> node_table;
+    HandleTable<EdgeTag> edge_table;
+
+    std::unordered_map<std::string, NodeHandle> nodes;
+    std::vector<std::unique_ptr<Node>> node_objects;  // by node id
+    std::vector<std::string> id_to_title;             // by node id
+
+    std::vector<std::unique_ptr<Line3D>> lines;  // by connection index
     Object3D_Collection collection;
 
-    bool physics_paused = true;
+    // Entries of collection.c are keyed by kind and handle slot, and
+    // collection_pos finds an entry again so it can be removed in O(1)
+    enum Kind : int { SPHERE, LINE, LABEL };
+    static constexpr int KIND_SHIFT = 29;
+    static int collectionKey(Kind kind, uint32_t slot) { return kind << KIND_SHIFT | int(slot); }
+    static Kind keyKind(int key) { return Kind(key >> KIND_SHIFT); }
+    static uint32_t keySlot(int key) { return uint32_t(key) & ((1u << KIND_SHIFT) - 1); }
+    std::vector<uint32_t> collection_pos[3];  // by kind, then slot
+
+    // Keeps collection.c back to front between frames
+    DepthOrder depth_order;
+
+    // Spheres and connections of the current frame, drawn in one call, and
+    // the labels that go on top of them. Label3D objects only provide the
+    // depth of a label; its text is drawn from label_atlas.
+    GeometryBatch geometry;
+    LabelAtlas label_atlas{FONT, LABEL_CHARACTER_SIZE};
+    size_t draw_calls = 0;  // last frame, scene only (no GUI or overlays)
+
+    // Level of detail by distance from the camera; see cullScene
+    float label_distance = 80.0f;
+    float far_distance = 800.0f;
+    float dot_radius = 1.5f;  // pixels
+
+    enum Detail : uint8_t { HIDDEN, DOT, FULL };
+    struct FrameNode {
+        vec4 view;  // camera space
+        float distance_sq;
+        Detail detail;
+        sf::Vector2f screen;
+        float radius;  // on screen
+        const LabelAtlas::Entry* label;  // FULL nodes with their label in front of the camera
+        sf::FloatRect label_rect;        // on screen
+    };
+    struct FrameEdge {
+        bool visible;
+        sf::Vector2f a, b;  // clipped, on screen
+        float width;
+    };
+    std::vector<FrameNode> frame_nodes;  // by node id, for the current frame
+    std::vector<FrameEdge> frame_edges;  // by connection index
 
-    
+    struct RenderStats {
+        size_t nodes_full = 0, nodes_dot = 0, nodes_culled = 0;
+        size_t edges_drawn = 0, edges_culled = 0;
+        size_t labels_drawn = 0;
+    } render_stats;
 
+    // Projected bounds of every entry of collection.c (by position in it),
+    // rebuilt each frame in render
+    ScreenGrid picking_grid;
 
-    /*
-    // ID system:
-        0 - nodes.size()-1: node/sphere with title id_to_title[i]
+    // Set by the main loop to time the phases of render
+    FrameProfiler* profiler = nullptr;
 
-        nodes.size() - nodes.size() + mm.connections.size()-1:
-    mm.connections[nodes.size()-i]
+    void lap(FrameProfiler::Phase phase) {
+        if (profiler) profiler->lap(phase);
+    }
 
-    nodes.size() + mm.connections.size() - nodes.size() * 2 +
-    mm.connections.size(): node with title id_to_title[nodes.size() +
-    mm.connections.size() - i]
-    */
-    std::vector<std::string> id_to_title;  // same size as nodes
+    FrameProfiler::Counts frameCounts() const {
+        FrameProfiler::Counts counts;
+        counts.nodes = nodes.size();
+        counts.connections = lines.size();
+        counts.nodes_drawn = render_stats.nodes_full + render_stats.nodes_dot;
+        counts.edges_drawn = render_stats.edges_drawn;
+        counts.labels_drawn = render_stats.labels_drawn;
+        counts.draw_calls = draw_calls;
+        counts.awake = physics_awake;
+        return counts;
+    }
 
+    // sim is the render-side copy: edits are applied to it immediately and
+    // forwarded to sim_thread, which owns the live simulation and sends
+    // positions back through snapshots
+    Simulation sim;
+    std::unique_ptr<SimulationThread> sim_thread;
+    bool physics_paused = true;
 
-    static vec4 rand_position() {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
+    // From the latest snapshot: kinetic energy, nodes still being integrated,
+    // and whether the layout has settled and the simulation stopped stepping
+    float physics_energy = 0;
+    size_t physics_awake = 0;
+    bool physics_idle = false;
+    uint64_t physics_version = 0;  // edits included in the positions we have
+
+    template <class Edit>
+    void edit_sim(Edit edit) {
+        edit(sim);
+        if (sim_thread) sim_thread->post(edit);
+    }
+
+
+    void collectionAdd(Kind kind, uint32_t slot, Object3D* object) {
+        auto& pos = collection_pos[kind];
+        if (pos.size() <= slot) pos.resize(slot + 1);
+        pos[slot] = collection.c.size();
+        collection.c.push_back({collectionKey(kind, slot), object});
+    }
+
+    // Swaps with the last entry; the depth order repairs itself next frame
+    void collectionRemove(Kind kind, uint32_t slot) {
+        uint32_t at = collection_pos[kind][slot];
+        collection.c[at] = collection.c.back();
+        collection.c.pop_back();
+        if (at < collection.c.size()) {
+            int key = collection.c[at].first;
+            collection_pos[keyKind(key)][keySlot(key)] = at;
+        }
+    }
+
+    // After collection.c has been reordered
+    void indexCollection() {
+        for (uint32_t k = 0; k < collection.c.size(); k++) {
+            int key = collection.c[k].first;
+            collection_pos[keyKind(key)][keySlot(key)] = k;
+        }
+    }
+
+    // Id of the node a collection key belongs to (SPHERE or LABEL)
+    size_t keyNodeId(int key) const { return node_table.index_of_slot(keySlot(key)); }
 
-        static std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
 
-        return vec4(dist(gen), dist(gen), dist(gen));
+    vec4 position(size_t id) const {
+        return vec4(sim.px[id], sim.py[id], sim.pz[id]);
     }
 
+    size_t idOf(NodeHandle node) const { return node_table.index(node); }
+    size_t idOf(const std::string& title) const { return node_table.index(nodes.at(title)); }
+    const std::string& titleOf(NodeHandle node) const { return id_to_title[idOf(node)]; }
+
     void update3DObjects() {
-        for (auto& node_pair : nodes) {
-            node_pair.second->sphere.position = node_pair.second->position;
-            node_pair.second->label.position = node_pair.second->position + LABEL_OFFSET;
+        for (size_t id = 0; id < node_objects.size(); id++) {
+            vec4 pos = position(id);
+            node_objects[id]->sphere.position = pos;
+            node_objects[id]->label.position = pos + LABEL_OFFSET;
         }
         for (size_t i = 0; i < lines.size(); i++) {
-            lines[i]->a = nodes[mm.connections[i].first]->position;
-            lines[i]->b = nodes[mm.connections[i].second]->position;
+            lines[i]->a = position(sim.edge_a[i]);
+            lines[i]->b = position(sim.edge_b[i]);
         }
     }
 
@@ -101,10 +241,15 @@ struct Physical_MM {
         SAVING
     };
 
+    // A node (hit on its sphere or label) or, if none, a connection
+    struct Pick {
+        NodeHandle node;
+        EdgeHandle edge;
+    };
+
     UserState user_state = UserState::DEFAULT;
-    int hover_id = -1;
-    int selected_id = -1;
-    int selected_id2 = -1;
+    Pick hover;
+    Pick selected;
     
     tgui::Gui gui;
 
@@ -133,7 +278,7 @@ struct Physical_MM {
         deletionWindow->close();    
         bodyEditorWindow->close();
         user_state = UserState::DEFAULT;
-        selected_id = selected_id2 = -1;
+        selected = Pick();
     }
 
 
@@ -167,32 +312,39 @@ struct Physical_MM {
     }
 
 
-    Physical_MM(MM mm_, Camera& camera) : mm(mm_), camera(camera), gui(camera.window) {
+    Physical_MM(MM mm_, Camera& camera) : Physical_MM(std::move(mm_), camera, LayoutPositions()) {}
+
+    // Nodes with a position in `layout` start there; the rest are placed by
+    // MultilevelLayout around them
+    Physical_MM(MM mm_, Camera& camera, const LayoutPositions& layout)
+        : mm(mm_), camera(camera), gui(camera.window) {
+        sim.thread_count = PHYSICS_THREADS;
+
         gui.loadWidgetsFromFile(BODY_GUI_PATH);
 
         bodyEditorWindow = gui.get<tgui::ChildWindow>("GuiWindow");
         bodyEditorWindow->setCloseBehavior(tgui::ChildWindow::CloseBehavior::Hide);
         bodyEditorWindow->onClose([&]() {
-            selected_id = -1; 
+            selected = Pick();
             camera.allowMouseLocking = true;
             user_state = UserState::DEFAULT;
         });
 
         bodyEditorEditBox = gui.get<tgui::EditBox>("TitleBox");
         bodyEditorEditBox->onTextChange([&](const tgui::String& text) {
-            changeNodeTitle(id_to_title[selected_id], text.toStdString());
+            changeNodeTitle(titleOf(selected.node), text.toStdString());
         });
         
         bodyEditorTextArea = gui.get<tgui::TextArea>("BodyBox");
         bodyEditorTextArea->onTextChange([&](const tgui::String& text) {
-            changeNodeBody(id_to_title[selected_id], text.toStdString());
+            changeNodeBody(titleOf(selected.node), text.toStdString());
         });
         
         addConnectionButton = gui.get<tgui::Button>("AddConnectionButton");
         addConnectionButton->onPress([&]() {
-            float temp = selected_id;
+            Pick temp = selected;
             bodyEditorWindow->close();
-            selected_id = temp;
+            selected = temp;
             user_state = UserState::CONNECTING;
         });
 
@@ -211,7 +363,7 @@ struct Physical_MM {
 
         tgui::Button::Ptr confirmDeletionButton = gui.get<tgui::Button>("ConfirmDeleteButton");
         confirmDeletionButton->onPress([&]() {
-            removeNode(id_to_title[selected_id]);
+            removeNode(titleOf(selected.node));
             exit_gui();
         });
 
@@ -229,12 +381,7 @@ struct Physical_MM {
 
         tgui::Button::Ptr confirmDeletionButton_connection = gui.get<tgui::Button>("DeleteConnectionButton");
         confirmDeletionButton_connection->onPress([&]() {
-            std::cout << mm.connections.size() << std::endl;
-            std::cout << selected_id-nodes.size() << std::endl;
-            mm.print();
-            auto& connection = mm.connections[selected_id-nodes.size()];
-            //std::cout << connection.first << " " << connection.second << std::endl;
-            removeConnection(connection.first, connection.second);
+            removeConnection(selected.edge);
             exit_gui();
         });
 
@@ -257,34 +404,31 @@ struct Physical_MM {
 
         //End of UI shenanigans
 
-        size_t id = 0;
+        node_objects.reserve(mm.nodes.size());
         for (auto& node : mm.nodes) {
-            vec4 position = rand_position();
-            vec4 velocity(0, 0, 0);
-            Sphere3D sphere(position, 1.0f);
-
-            nodes[node.first] = std::make_unique<Node>(position, velocity, sphere, node.first);
+            NodeHandle handle = node_table.insert();
+            nodes[node.first] = handle;
+            node_objects.push_back(std::make_unique<Node>(vec4(), node.first));
+            sim.add_node(0, 0, 0);
             id_to_title.push_back(node.first);
 
-            collection.c.push_back({id, &nodes[node.first]->sphere});
-
-            id++;
+            collectionAdd(SPHERE, handle.slot, &node_objects.back()->sphere);
+            collectionAdd(LABEL, handle.slot, &node_objects.back()->label);
         }
 
         lines.reserve(mm.connections.size());
 
         for (auto& connection : mm.connections) {
-            lines.push_back(std::make_unique<Line3D>(nodes[connection.first]->position,
-                    nodes[connection.second]->position, 1.0f));
+            sim.add_edge(idOf(mm.title(connection.first)), idOf(mm.title(connection.second)));
+            lines.push_back(std::make_unique<Line3D>(vec4(), vec4(), LINE_THICKNESS));
 
-            collection.c.push_back({id, lines.back().get()});
-            id++;
+            collectionAdd(LINE, edge_table.insert().slot, lines.back().get());
         }
 
-        for (auto& node : mm.nodes) {
-            collection.c.push_back({id, &nodes[node.first]->label});
-            id++;
-        }
+        std::vector<uint8_t> placed;
+        apply_layout(layout, id_to_title, sim, placed);
+        MultilevelLayout().place_missing(sim, placed);
+        update3DObjects();
 
         //mm.print();
     }
@@ -301,7 +445,11 @@ struct Physical_MM {
         assert(are_sizes_matching());
     }
 
-    void addNode(vec4 position) {
+    // Edits below cost O(degree of the node involved): the last node or
+    // connection moves into the freed id, and only its handle slot and
+    // collection entry need telling
+
+    NodeHandle addNode(vec4 position) {
         //Find valid title 'New Node' or 'New Node 1', etc.
         std::string new_title = "New Node";
         int title_iteration = 1;
@@ -309,80 +457,54 @@ struct Physical_MM {
         
         //Adding to non-physical MM
         mm.nodes[new_title] = "New Body";
+        changes.node_written(new_title);
 
-        //Adding to nodes
-        Sphere3D sphere(position, 1.0f);
-        nodes[new_title] = std::make_unique<Node>(position, vec4(), sphere, new_title);
-
-        //Adding to collections; incrementing ids; adding to id-name store;
-        int new_id = nodes.size() -1;
+        //Adding to nodes and the simulation
+        NodeHandle handle = node_table.insert();
+        nodes[new_title] = handle;
+        node_objects.push_back(std::make_unique<Node>(position, new_title));
         id_to_title.push_back(new_title);
+        edit_sim([position](Simulation& s) { s.add_node(position.x, position.y, position.z); });
 
-        for (auto& pair : collection.c) {
-            if (pair.first >= new_id) {
-                pair.first++;
-            }
-        }
-
-        collection.c.push_back({new_id, &nodes[new_title]->sphere});
+        //Adding to collection
+        collectionAdd(SPHERE, handle.slot, &node_objects.back()->sphere);
+        collectionAdd(LABEL, handle.slot, &node_objects.back()->label);
 
-        collection.c.push_back({new_id + nodes.size() + mm.connections.size(), &nodes[new_title]->label});
-        
+        float xyz[3] = {position.x, position.y, position.z};
+        journalEdit(JournalOp::ADD_NODE, {new_title, "New Body", std::string_view((const char*)xyz, sizeof(xyz))});
 
         validityCheck();
+        return handle;
     }
 
     void removeNode(std::string title) {
         assert(mm.nodes.contains(title) && nodes.contains(title));
 
-        //Getting ID
-        auto it = std::find(id_to_title.begin(), id_to_title.end(), title);
-        assert(it != id_to_title.end());
-        int id = std::distance(id_to_title.begin(), it);
-
-        
-
-        //Removing
-        id_to_title.erase(it);
-        mm.nodes.erase(title);
-        nodes.erase(title);
-
-        //Removing from collection
-        int label_id = id + nodes.size() + mm.connections.size() + 1;
-        std::erase_if(collection.c, [id, label_id](const auto& p) {
-            return p.first == id || p.first == label_id;  // Remove both!
-        });
-
-
-        std::erase_if(collection.c, [id](const auto& p) {
-            return p.first == id;
-        });
-
-        //Decrementing collections
-        for (auto& pair : collection.c) {
-            if (pair.first > label_id) {
-                pair.first-=2;
-            } else if (pair.first > id) {
-                pair.first--; 
-            }
-        }
+        NodeHandle handle = nodes[title];
+        size_t id = idOf(handle);
 
+        changes.node_deleted(title);
 
         //Removing all connections that once attached to this node but now must suffer the fate of death
-        size_t i = 0;
-        while (i < mm.connections.size()) {
-            const auto& conn = mm.connections[i];
-            
-            if (conn.first == title || conn.second == title) {
-                // removeConnection handles mm.connections, lines, and collection.c
-                // It uses .erase(), so we DO NOT increment 'i'
-                removeConnection(conn.first, conn.second, false);
-            } else {
-                // Only move to the next index if we didn't delete anything
-                i++;
-            }
+        //Removing an edge never changes node ids, only which edge sits where
+        while (!sim.incident_edges(id).empty()) {
+            removeConnectionAt(sim.incident_edges(id).back(), false);
         }
 
+        //Removing from collection
+        collectionRemove(SPHERE, handle.slot);
+        collectionRemove(LABEL, handle.slot);
+        label_atlas.forget(title);
+
+        //Removing; the last node takes over this id
+        swap_and_pop(node_objects, id);
+        swap_and_pop(id_to_title, id);
+        node_table.remove(id);
+        edit_sim([id](Simulation& s) { s.remove_node(id); });
+        mm.erase_node(title);
+        nodes.erase(title);
+        journalEdit(JournalOp::REMOVE_NODE, {title});
+
         validityCheck();
     }
 
@@ -392,30 +514,24 @@ struct Physical_MM {
         assert(mm.nodes.contains(oldTitle) && nodes.contains(oldTitle));
         assert(!(mm.nodes.contains(newTitle) || nodes.contains(newTitle)));
 
-        mm.nodes[newTitle] = std::move(mm.nodes[oldTitle]);
-        mm.nodes.erase(oldTitle);
+        mm.rename_node(oldTitle, newTitle);
+        changes.node_deleted(oldTitle);
+        changes.node_written(newTitle);
 
-        auto it = std::find(id_to_title.begin(), id_to_title.end(), oldTitle);
-        assert(it != id_to_title.end());
-        int id = std::distance(id_to_title.begin(), it);
+        NodeHandle handle = nodes[oldTitle];
+        size_t id = idOf(handle);
         
         id_to_title[id] = newTitle;
-        nodes[newTitle] = std::move(nodes[oldTitle]);
         nodes.erase(oldTitle);
+        nodes[newTitle] = handle;
 
-        nodes[newTitle]->label = Label3D(nodes[newTitle]->position + LABEL_OFFSET, newTitle, FONT);
-        for (auto& pair : collection.c) {
-            // If this ID corresponds to the label of the node we just renamed
-            if (pair.first == id + nodes.size() + mm.connections.size()) {
-                pair.second = &nodes[newTitle]->label;
-            }
-        }
+        //Only the atlas entry needs redoing; the Label3D keeps supplying the depth
+        label_atlas.forget(oldTitle);
 
-        //Updating connections who previously referred to the old title
-        for (auto& connection : mm.connections) {
-            if (connection.first == oldTitle) connection.first = newTitle;
-            if (connection.second == oldTitle) connection.second = newTitle;
-        }
+        //Connections refer to the node by id and need no change; their file does
+        if (!sim.incident_edges(id).empty()) changes.connections = true;
+
+        journalEdit(JournalOp::RENAME_NODE, {oldTitle, newTitle});
 
         validityCheck();
     }
@@ -423,7 +539,9 @@ struct Physical_MM {
     void changeNodeBody(std::string title, std::string body) {
         assert(mm.nodes.contains(title) && nodes.contains(title));
 
-        mm.nodes[title] = body;
+        mm.set_body(title, body);
+        changes.node_written(title);
+        journalEdit(JournalOp::SET_BODY, {title, body});
 
         validityCheck();
     }
@@ -431,148 +549,294 @@ struct Physical_MM {
 
     // = = = ADDITION/REMOVAL/EDITING PROTOCOLS FOR CONNECTIONS = = =
 
-    void addConnection(std::string first, std::string second) {
-        auto it = std::find_if(mm.connections.begin(), mm.connections.end(),
-            [&](const auto& p) {
-                return (p.first == first && p.second == second) ||
-                    (p.first == second && p.second == first);
-        });
+    // Returns none if the two are already connected
+    EdgeHandle addConnection(std::string first, std::string second) {
+        if (mm.find_connection(first, second) != -1) return EdgeHandle();
+        size_t a = idOf(first);
+        size_t b = idOf(second);
 
-        if (it != mm.connections.end()) return;
+        mm.connect(first, second);
+        changes.connections = true;
 
+        //Adding line and spring
+        edit_sim([a, b](Simulation& s) { s.add_edge(a, b); });
+        lines.push_back(std::make_unique<Line3D>(position(a), position(b), LINE_THICKNESS));
 
-        int id = nodes.size() + mm.connections.size();
+        //Adding to collection
+        EdgeHandle handle = edge_table.insert();
+        collectionAdd(LINE, handle.slot, lines.back().get());
 
-        mm.connections.push_back(std::make_pair(first, second));
+        journalEdit(JournalOp::ADD_CONNECTION, {first, second});
 
-        std::cout << "pushed connection" << std::endl;
-        //Adding line
-        lines.push_back(std::make_unique<Line3D>(nodes[first]->position, nodes[second]->position, 1.0f));
-        
-        //Incrementing ids:
-        for (auto& pair : collection.c) {
-            if (pair.first >= id) {
-                pair.first++;
-            }
-        }
+        validityCheck();
+        return handle;
+    }
 
-        std::cout << "pushed line and incremented stuff" << std::endl;
+    void removeConnection(std::string first, std::string second, bool checkValidity = true) {
+        int64_t index = mm.find_connection(first, second);
+        assert(index != -1);
+        removeConnectionAt(index, checkValidity);
+    }
 
-        //Adding to collections
-        collection.c.push_back({id, lines.back().get()});
+    void removeConnection(EdgeHandle connection, bool checkValidity = true) {
+        removeConnectionAt(edge_table.index(connection), checkValidity);
+    }
 
+    // index into mm.connections (and the sim's edges); the last connection
+    // takes over the index
+    void removeConnectionAt(size_t index, bool checkValidity = true) {
+        assert(index < mm.connections.size());
 
-        std::cout << "pushed collection" << std::endl;
-        
-        validityCheck();
+        collectionRemove(LINE, edge_table.at(index).slot);
+        std::string first = mm.title(mm.connections[index].first);
+        std::string second = mm.title(mm.connections[index].second);
+
+        swap_and_pop(lines, index);
+        mm.disconnect_at(index);
+        changes.connections = true;
+        edge_table.remove(index);
+        edit_sim([index](Simulation& s) { s.remove_edge(index); });
+
+        journalEdit(JournalOp::REMOVE_CONNECTION, {first, second});
+
+        if (checkValidity) validityCheck();
     }
 
-    void removeConnection(std::string first, std::string second, bool checkValidity = true) {
-        auto it = std::find_if(mm.connections.begin(), mm.connections.end(),
-            [&](const auto& p) {
-                return (p.first == first && p.second == second) ||
-                    (p.first == second && p.second == first);
-        }); 
-        assert(it != mm.connections.end());
-        int index = std::distance(mm.connections.begin(), it);        
-        
-        int id = index + nodes.size();
 
-        //Erasing from collection
-        std::erase_if(collection.c, [id](const auto& p) {
-            return p.first == id;
-        });
 
-        lines.erase(lines.begin() + index);
-        mm.connections.erase(it);
+    // = = = REGULAR UPDATES = = =
 
-        //Decrementing ids in collection
-        for (auto& pair : collection.c) {
-             if (pair.first > id) {
-                pair.first --;
+    // Works out once per frame, before anything is drawn or picked, which
+    // nodes and connections can be seen and at what level of detail:
+    // - FULL: sphere and label, up to label_distance from the camera
+    // - DOT: a small fixed-size dot, no label, up to far_distance
+    // - HIDDEN: outside the view frustum or past far_distance
+    // Connections are drawn while either end is within far_distance, cut at
+    // the near plane and at the window border, so an edge to a node off
+    // screen or behind the camera still shows its visible part.
+    void cullScene(const ScreenProjection& projection) {
+        render_stats = RenderStats();
+        const float far_sq = far_distance * far_distance;
+        const float label_sq = label_distance * label_distance;
+
+        frame_nodes.resize(sim.size());
+        for (size_t i = 0; i < sim.size(); i++) {
+            FrameNode& node = frame_nodes[i];
+            node.view = projection.to_camera(position(i));
+            node.distance_sq = node.view.x * node.view.x + node.view.y * node.view.y +
+                               node.view.z * node.view.z;
+            node.detail = HIDDEN;
+            node.label = nullptr;
+
+            if (node.distance_sq > far_sq || !ScreenProjection::in_front(node.view) ||
+                !projection.sphere_in_view(node.view, NODE_RADIUS)) {
+                render_stats.nodes_culled++;
+                continue;
+            }
+            node.screen = projection.to_screen(node.view);
+            if (node.distance_sq <= label_sq) {
+                node.detail = FULL;
+                node.radius = projection.radius_on_screen(NODE_RADIUS, node.view);
+                render_stats.nodes_full++;
+
+                //Label text centred just above the label point
+                vec4 c = projection.to_camera(position(i) + LABEL_OFFSET);
+                if (ScreenProjection::in_front(c)) {
+                    node.label = &label_atlas.get(id_to_title[i]);
+                    sf::Vector2f size(node.label->rect.size);
+                    node.label_rect = sf::FloatRect(projection.to_screen(c) - sf::Vector2f(size.x * 0.5f, size.y), size);
+                }
+            } else {
+                node.detail = DOT;
+                node.radius = dot_radius;
+                render_stats.nodes_dot++;
             }
         }
-    
 
-        if (checkValidity) validityCheck();
+        frame_edges.resize(sim.edge_count());
+        for (size_t e = 0; e < sim.edge_count(); e++) {
+            FrameEdge& edge = frame_edges[e];
+            const FrameNode& a = frame_nodes[sim.edge_a[e]];
+            const FrameNode& b = frame_nodes[sim.edge_b[e]];
+            edge.visible = false;
+
+            vec4 va = a.view, vb = b.view;
+            if (std::min(a.distance_sq, b.distance_sq) <= far_sq &&
+                ScreenProjection::clip_to_near(va, vb)) {
+                //Thickness is in world units, so each end keeps its own width
+                //on screen; the average is close enough for a thin line
+                edge.width = std::max(1.0f, 0.5f * (projection.radius_on_screen(LINE_THICKNESS, va) +
+                                                    projection.radius_on_screen(LINE_THICKNESS, vb)));
+                edge.a = projection.to_screen(va);
+                edge.b = projection.to_screen(vb);
+                edge.visible = projection.clip_to_window(edge.a, edge.b, edge.width);
+            }
+
+            if (edge.visible) render_stats.edges_drawn++;
+            else render_stats.edges_culled++;
+        }
     }
 
+    // Registers the screen-space footprint of every visible collection entry
+    // with picking_grid
+    void buildPickingGrid(sf::RenderWindow& window) {
+        picking_grid.reset(window.getSize(), collection.c.size());
 
+        for (uint32_t k = 0; k < collection.c.size(); k++) {
+            int key = collection.c[k].first;
 
+            if (keyKind(key) == SPHERE) {
+                const FrameNode& node = frame_nodes[keyNodeId(key)];
+                if (node.detail == HIDDEN) continue;
+                float r = node.radius;
+                picking_grid.insert_box(k, sf::FloatRect(node.screen - sf::Vector2f(r, r), sf::Vector2f(2 * r, 2 * r)));
 
-    // = = = REGULAR UPDATES = = =
+            } else if (keyKind(key) == LINE) {
+                const FrameEdge& edge = frame_edges[edge_table.index_of_slot(keySlot(key))];
+                if (!edge.visible) continue;
+                picking_grid.insert_segment(k, edge.a, edge.b, std::max(2.0f, edge.width));
 
-    void render(sf::RenderWindow& window, Camera& camera) {
-        collection.depthSort(camera);
-
-        hover_id = -1;
-        int hover_id_connection = -1;
-
-        // If our mouse hovers both a node and a connection, we want to prefer
-        // the node
-        for (auto it = collection.c.rbegin(); it != collection.c.rend(); ++it) {
-            auto shape = it->second->computeShape(window, camera);
-            if (!shape) continue;
-
-            sf::Vector2f mousePos = sf::Vector2f(sf::Mouse::getPosition(window));
-            if (shape->computeCollisionWithPoint(mousePos)) {
-                if (it->first < nodes.size() ||
-                    it->first >= nodes.size() + mm.connections.size()) {  // NODE ALERT
-                    hover_id = it->first;
-                    break;
-                } else {  // Meh... a connection. Only add this if we have not
-                          // found a connection before. Even then, continue the
-                          // search for a node if possible
-                    if (hover_id_connection == -1 && hover_id == -1) {
-                        hover_id_connection = it->first;
-                    }
-                }
+            } else {
+                const FrameNode& node = frame_nodes[keyNodeId(key)];
+                if (node.label) picking_grid.insert_box(k, node.label_rect);
             }
         }
+    }
 
-        if (hover_id == -1) {
-            hover_id = hover_id_connection;
-        } else if (hover_id >= nodes.size() + mm.connections.size()) {
-            hover_id -= nodes.size() + mm.connections.size();
+    // Nodes whose sphere or label overlaps a screen rectangle, using the grid
+    // from the last render (e.g. for box selection)
+    std::vector<NodeHandle> nodesInScreenRect(sf::FloatRect rect) {
+        std::vector<NodeHandle> found;
+        for (uint32_t k : picking_grid.in_rect(rect)) {
+            if (k >= collection.c.size()) continue;  // removed since
+            int key = collection.c[k].first;
+            if (keyKind(key) != LINE) found.push_back(node_table.key_of_slot(keySlot(key)));
         }
+        std::sort(found.begin(), found.end(),
+                  [](NodeHandle a, NodeHandle b) { return a.slot < b.slot; });
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        return found;
+    }
+
+    // Spheres, dots and connections go into one batch in depth order, labels
+    // of FULL nodes are drawn after it from the atlas
+    void drawScene(sf::RenderWindow& window) {
+        geometry.clear();
+        label_atlas.clear();
+        size_t labels = 0;
 
         for (auto& pair : collection.c) {
-            if ( pair.first == hover_id ||
-                pair.first - nodes.size() - mm.connections.size() == hover_id && hover_id != -1) {
-                pair.second->draw(window, camera, HIGHLIGHT_COLOR);
+            const int key = pair.first;
+            const Kind kind = keyKind(key);
+            bool highlighted = kind == LINE ? keySlot(key) == hover.edge.slot
+                                            : keySlot(key) == hover.node.slot;
+            sf::Color color = highlighted ? HIGHLIGHT_COLOR : sf::Color::White;
+
+            if (kind == SPHERE) {
+                const FrameNode& node = frame_nodes[keyNodeId(key)];
+                if (node.detail == FULL) {
+                    geometry.add_disc(node.screen, node.radius, color);
+                } else if (node.detail == DOT) {
+                    sf::Vector2f half_width(node.radius, 0);
+                    geometry.add_segment(node.screen - half_width, node.screen + half_width,
+                                         2 * node.radius, color);
+                }
+            } else if (kind == LINE) {
+                const FrameEdge& edge = frame_edges[edge_table.index_of_slot(keySlot(key))];
+                if (edge.visible) geometry.add_segment(edge.a, edge.b, edge.width, color);
+            } else if (const FrameNode& node = frame_nodes[keyNodeId(key)]; node.label) {
+                label_atlas.add(*node.label, node.label_rect.position, color);
+                labels++;
+            }
+        }
+
+        geometry.draw(window);
+        draw_calls = 1 + label_atlas.draw(window);
+        render_stats.labels_drawn = labels;
+
+        //Needed in Windows to prevent font drawing from corrupting everything else
+        window.resetGLStates();
+    }
+
+    void render(sf::RenderWindow& window, Camera& camera) {
+        depth_order.sort(collection.c, [&camera](const auto& pair) {
+            return pair.second->calculateDistance(camera);
+        });
+        indexCollection();
+        lap(FrameProfiler::SORT);
+
+        ScreenProjection projection(camera, window);
+        cullScene(projection);
+        lap(FrameProfiler::CULL);
+
+        buildPickingGrid(window);
+
+        hover = Pick();
+        EdgeHandle hover_connection;
+
+        // Only the entries in the grid cell under the mouse get their exact
+        // shape tested, nearest first. If our mouse hovers both a node and a
+        // connection, we want to prefer the node
+        sf::Vector2f mousePos = sf::Vector2f(sf::Mouse::getPosition(window));
+        sf::Vector2f windowSize = sf::Vector2f(window.getSize());
+        bool mouseInWindow = mousePos.x >= 0 && mousePos.y >= 0 &&
+                             mousePos.x < windowSize.x && mousePos.y < windowSize.y;
+        const std::vector<uint32_t> no_candidates;
+        const auto& candidates = mouseInWindow ? picking_grid.at(mousePos) : no_candidates;
+
+        for (auto k = candidates.rbegin(); k != candidates.rend(); ++k) {
+            auto* it = &collection.c[*k];
+            const Kind kind = keyKind(it->first);
+            bool hit;
+            if (kind == LABEL) {
+                //Labels are drawn from the atlas, so their quad is their shape
+                hit = frame_nodes[keyNodeId(it->first)].label_rect.contains(mousePos);
+            } else if (kind == SPHERE && frame_nodes[keyNodeId(it->first)].detail == DOT) {
+                //A dot is a dot_radius square whatever the sphere's size, and
+                //its grid box is that square
+                hit = picking_grid.box(*k).contains(mousePos);
             } else {
-                pair.second->draw(window, camera, sf::Color::White);
+                auto shape = it->second->computeShape(window, camera);
+                hit = shape && shape->computeCollisionWithPoint(mousePos);
+            }
+            if (!hit) continue;
+
+            if (kind != LINE) {  // NODE ALERT
+                hover.node = node_table.key_of_slot(keySlot(it->first));
+                break;
+            } else if (hover_connection.is_none()) {  // Meh... a connection. Only
+                // keep the first one, and continue the search for a node if possible
+                hover_connection = edge_table.key_of_slot(keySlot(it->first));
             }
-            //Needed in Windows to prevent font drawing from corrupting everything else
-            //More efficient way to do this if you draw all the fonts, run this once, and draw everything else
-            window.resetGLStates();
         }
 
-        if (user_state == UserState::WRITING) {
+        if (hover.node.is_none()) hover.edge = hover_connection;
+        lap(FrameProfiler::PICKING);
+
+        drawScene(window);
+        lap(FrameProfiler::DRAW);
+
+        if (user_state == UserState::WRITING && node_table.valid(selected.node)) {
             //we selected a node 
             tgui::Vector2f ui_pos = bodyEditorWindow->getPosition();
-            std::string title = id_to_title[selected_id];
-            Node& node = *(nodes[title]);
-            draw3DLineTo2DPoint(window, node.position, ui_pos, camera, 3.0, LINE_LABEL_COLOR);
+            draw3DLineTo2DPoint(window, position(idOf(selected.node)), ui_pos, camera, 3.0, LINE_LABEL_COLOR);
                 
-        } else if (user_state == UserState::CONNECTING) {
+        } else if (user_state == UserState::CONNECTING && node_table.valid(selected.node)) {
             //we are in the process of forming a new connection
-            std::string title = id_to_title[selected_id];
-            Node& node = *(nodes[title]);
-
             sf::Vector2f mouse = sf::Vector2f(sf::Mouse::getPosition(window));
 
-            draw3DLineTo2DPoint(window, node.position, mouse, camera, 3.0, NEW_CONNECTION_COLOR);
+            draw3DLineTo2DPoint(window, position(idOf(selected.node)), mouse, camera, 3.0, NEW_CONNECTION_COLOR);
 
-        } else if (user_state == UserState::PRUNING) { // we selected a connection
+        } else if (user_state == UserState::PRUNING && edge_table.valid(selected.edge)) { // we selected a connection
             tgui::Vector2f ui_pos = deletionWindow_connection->getPosition();
 
-            int connection_index = selected_id - nodes.size();
+            size_t connection_index = edge_table.index(selected.edge);
             vec4 midPos = (lines[connection_index]->a + lines[connection_index]->b) * 0.5f;
             draw3DLineTo2DPoint(window, midPos, ui_pos, camera, 3.0, LINE_LABEL_COLOR);
         }
 
         gui.draw();
+        lap(FrameProfiler::GUI);
     }
 
 
@@ -583,33 +847,34 @@ struct Physical_MM {
         bool typing = isUserTyping();
         if (const auto* mouseButtonPressed = event->getIf<sf::Event::MouseButtonPressed>()) {
             if (mouseButtonPressed->button == sf::Mouse::Button::Left) {  
-                if (hover_id != -1) {
-                    if (hover_id < nodes.size()) { //we selected a true node
+                //The hover is from the last render; an earlier event may have removed it since
+                bool hover_node = node_table.valid(hover.node);
+                if (hover_node || edge_table.valid(hover.edge)) {
+                    if (hover_node) { //we selected a true node
                         if (user_state == UserState::CONNECTING) {
                             std::cout << "Connecting" << std::endl;
-                            if (hover_id != selected_id) {
-                                std::cout << selected_id << " " << hover_id << std::endl;
-                                addConnection(id_to_title[selected_id], id_to_title[hover_id]);
+                            if (hover.node != selected.node && node_table.valid(selected.node)) {
+                                addConnection(titleOf(selected.node), titleOf(hover.node));
                             }
                             
                             user_state = UserState::DEFAULT;
                         } else {
                             deletionWindow_connection->close();
 
-                            selected_id = hover_id;
+                            selected = hover;
                             camera.allowMouseLocking = false;
                             camera.mouseLocked = false;
                             sf::Vector2f ui_pos = rand_2d_pos(window);
                             bodyEditorWindow->setVisible(true);
                             bodyEditorWindow->setPosition(ui_pos.x, ui_pos.y);
-                            bodyEditorEditBox->setText(id_to_title[selected_id]);
-                            bodyEditorTextArea->setText(mm.nodes[id_to_title[selected_id]]);
+                            bodyEditorEditBox->setText(titleOf(selected.node));
+                            bodyEditorTextArea->setText(mm.body(titleOf(selected.node)));
                             user_state = UserState::WRITING;
                         }
                     } else { // we selected a chud connection
                         bodyEditorWindow->close();
                         
-                        selected_id = hover_id;
+                        selected = hover;
                         camera.allowMouseLocking = false;
                         camera.mouseLocked = false;
                         sf::Vector2f ui_pos = rand_2d_pos(window);
@@ -622,6 +887,17 @@ struct Physical_MM {
         } else if (const auto* keyPressed = event->getIf<sf::Event::KeyPressed>()) {
             if (!typing && keyPressed->scancode == sf::Keyboard::Scan::Space) {
                 physics_paused = !physics_paused;
+            } else if (!typing && keyPressed->scancode == sf::Keyboard::Scan::B) {
+                auto mode = sim.repulsion_mode == Simulation::EXACT
+                                ? Simulation::BARNES_HUT
+                                : Simulation::EXACT;
+                edit_sim([mode](Simulation& s) {
+                    s.repulsion_mode = mode;
+                    s.wake_all();
+                });
+                std::cout << "Repulsion: "
+                          << (sim.repulsion_mode == Simulation::EXACT ? "exact" : "Barnes-Hut")
+                          << std::endl;
             } else if (keyPressed->scancode == sf::Keyboard::Scan::Escape) {
                     exit_gui();
             }
@@ -634,58 +910,40 @@ struct Physical_MM {
         return typing;
     }
 
-    void physics_step() {
-        if (physics_paused) return;
-        /*
-        Forces:
-        - Attractive connection force (hooke's law)
-        - Repelling node force (columb's law)
-        - Dampening friction force
-        - Bounding attractive force
-        */
-        const float evth_const = 0.1;
-        const float hooke_K = 0.01 * evth_const;
-        const float columb_K = 250 * evth_const;
-        const float dampening_constant = std::pow(0.9, evth_const);
-        const float bounding_constant = 0.000001 * evth_const;
-
-        //Update velocities
-        for (auto& connection : mm.connections) {
-            vec4& pos1 = nodes[connection.first]->position;
-            vec4& pos2 = nodes[connection.second]->position;
-            nodes[connection.first]->velocity += (pos2 - pos1)*hooke_K;
-            nodes[connection.second]->velocity += (pos1 - pos2)*hooke_K;
-        }
-
-        for (auto& node_pair_i: nodes) {
-            //Columb's force + bounding attractive force
-            for (auto& node_pair_j: nodes) {
-                if (&node_pair_i==&node_pair_j) continue;
-                
-                float x_dist = node_pair_i.second->position.x-node_pair_j.second->position.x;
-                float y_dist = node_pair_i.second->position.y-node_pair_j.second->position.y;
-                float z_dist = node_pair_i.second->position.z-node_pair_j.second->position.z;
-
-                float r_cubed = pow(pow(x_dist, 2) + pow(y_dist, 2) + pow(z_dist, 2), 1.5);
-
-                vec4 columb_factor(columb_K*x_dist/r_cubed, columb_K*y_dist/r_cubed, columb_K*z_dist/r_cubed);
-                vec4 bounding_factor(-bounding_constant * x_dist, -bounding_constant * y_dist, -bounding_constant * z_dist);
-                node_pair_i.second->velocity += columb_factor + bounding_factor;
-            }
-            
-            //Dampening force
-            node_pair_i.second->velocity *= dampening_constant;
-
-        }
-
-        //Update positions
-        for (auto& node_pair : nodes) {
-            node_pair.second->position += node_pair.second->velocity;
+    // Called once per frame. The stepping itself happens on sim_thread at its
+    // own rate; this only forwards the pause state and picks up the newest
+    // positions, skipping snapshots taken before our latest edit. Returns
+    // whether positions were updated.
+    bool physics_step() {
+        if (!sim_thread) sim_thread = std::make_unique<SimulationThread>(sim);
+        sim_thread->set_paused(physics_paused);
+
+        const SimSnapshot* snapshot = sim_thread->poll();
+        if (!snapshot || snapshot->version != sim_thread->posted()) return false;
+        assert(snapshot->px.size() == sim.size());
+        physics_version = snapshot->version;
+
+        sim.px = snapshot->px;
+        sim.py = snapshot->py;
+        sim.pz = snapshot->pz;
+
+        if (snapshot->idle && !physics_idle) {
+            std::cout << "Layout settled (energy " << snapshot->energy << ")" << std::endl;
         }
+        physics_energy = snapshot->energy;
+        physics_awake = snapshot->awake;
+        physics_idle = snapshot->idle;
 
         //Update objects
         update3DObjects();
+        return true;
+    }
 
+    // Whether new positions may still arrive without any input: the layout
+    // is running, or sim_thread has not caught up with our edits yet
+    bool physicsRunning() const {
+        if (!sim_thread) return true;
+        return (!physics_paused && !physics_idle) || physics_version != sim_thread->posted();
     }
 
     //FILE IO
@@ -693,61 +951,136 @@ struct Physical_MM {
 
     bool are_sizes_matching() const {
         return mm.nodes.size() == nodes.size() &&
-               mm.connections.size() == lines.size();
-    }
-
-    //*
-    Physical_MM(std::string path, Camera& camera)
-    : Physical_MM(
-          [&path]() {
-              assert(fs::exists(path) && fs::is_directory(path));
-              return MM(path + "/Mental-Model");
-          }(),
-          camera
-      ) {
-        // At this point, the delegating constructor has already:
-        // 1. Populated 'nodes' with random positions
-        // 2. Created all 'lines'
-        // 3. Populated the 'collection' for rendering
-
-        std::string bin_path = path + "/physics.bin";
-        std::ifstream bin(bin_path, std::ios::binary);
-
-        if (!bin.is_open()) {
-            // If physics file is missing, we just keep the random positions
-            return;
+               mm.connections.size() == lines.size() &&
+               node_objects.size() == nodes.size() &&
+               id_to_title.size() == nodes.size() &&
+               node_table.size() == nodes.size() &&
+               edge_table.size() == lines.size() &&
+               sim.size() == nodes.size() &&
+               sim.edge_count() == lines.size();
+    }
+
+    // Edits since the model was loaded from or fully saved to changes.base;
+    // saving there again only writes those (see incremental_save.hpp)
+    ModelChanges changes;
+    bool incremental_save = true;
+
+    // Every edit is also appended to changes.base/journal.log, so it
+    // survives a crash without a save (see journal.hpp). Past
+    // journal_compact_bytes the edits are saved in the background and the
+    // journal starts over.
+    std::unique_ptr<Journal> journal;
+    uint64_t journal_compact_bytes = 4 << 20;
+    std::future<void> compaction;
+    ModelChanges compacting;  // changes the running compaction is saving
+
+    // The .mmpack file unread bodies are mapped from, if loaded from one
+    std::string packed_source;
+
+    // A model directory (Mental-Model/ plus physics.bin) or a .mmpack file.
+    // Only titles and connections are read up front; a body is read when its
+    // node is first opened (see BodyCache).
+    Physical_MM(std::string path, Camera& camera) : Physical_MM(load(path), camera) {
+        if (is_packed_path(path)) packed_source = path;
+    }
+
+    static ModelDirectory load(const std::string& path) {
+        if (is_packed_path(path)) {
+            auto pack = std::make_shared<const PackedModel>(path);
+            return ModelDirectory{lazy_packed_mm(pack), pack->layout_positions()};
         }
 
-        uint64_t count;
-        bin.read(reinterpret_cast<char*>(&count), sizeof(count));
+        assert(fs::exists(path) && fs::is_directory(path));
+        ModelDirectory model = load_model_directory(path, true);
+        if (model.replayed > 0) {
+            std::cout << "Replayed " << model.replayed << " unsaved edits from the journal" << std::endl;
+        }
+        return model;
+    }
 
-        for (uint64_t i = 0; i < count; ++i) {
-            uint64_t len;
-            bin.read(reinterpret_cast<char*>(&len), sizeof(len));
+    Physical_MM(ModelDirectory loaded, Camera& camera)
+        : Physical_MM(std::move(loaded.mm), camera, loaded.layout) {
+        changes = std::move(loaded.changes);
+        if (!changes.base.empty()) openJournal(loaded.journal_sequence);
+    }
 
-            std::string title(len, '\0');
-            bin.read(title.data(), len);
+    void openJournal(uint64_t last_sequence) {
+        journal = std::make_unique<Journal>(changes.base, last_sequence + 1);
+    }
 
-            float coords[3];
-            bin.read(reinterpret_cast<char*>(coords), sizeof(coords));
+    // Called once an edit and its `changes` are fully applied: the record can
+    // start a compaction, which saves the model as it is now and then drops
+    // the record from the journal
+    void journalEdit(JournalOp op, std::initializer_list<std::string_view> args) {
+        if (!journal) return;
+        journal->append(op, args);
+        if (journal->size_bytes() > journal_compact_bytes) compactJournal();
+    }
 
-            // Update the node position if the title exists in our MM
-            if (nodes.count(title)) {
-                nodes[title]->position = vec4(coords[0], coords[1], coords[2]);
-            }
+    // Saves the edits so far to changes.base on another thread; the journal
+    // then drops the records that save holds. Only the files to write are
+    // copied here, as with any incremental save.
+    void compactJournal() {
+        if (compaction.valid()) {
+            if (compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+            finishCompaction();
         }
+        if (!are_sizes_matching()) return;
+
+        SaveSnapshot snapshot = snapshot_changes(mm, changes, id_to_title, sim, journal->last_sequence());
+        compacting = changes;
+        changes.reset(changes.base);
+        compaction = std::async(std::launch::async,
+            [base = changes.base, journal = journal.get(), snapshot = std::move(snapshot)] {
+                write_snapshot(base, snapshot);
+                journal->drop_through(snapshot.journal_sequence);
+            });
+    }
 
-        bin.close();
-
-        // Synchronize the spheres and lines to the loaded positions
-        update3DObjects();
+    // Waits for the running compaction, if any. If it failed, what it was
+    // saving is owed to the next save again.
+    void finishCompaction() {
+        if (!compaction.valid()) return;
+        try {
+            compaction.get();
+        } catch (const std::exception& e) {
+            std::cerr << "Journal compaction failed: " << e.what() << std::endl;
+            compacting.merge(changes);
+            changes = std::move(compacting);
+        }
     }
 
-    void save(std::string path) {
+    // To a .mmpack file if the path ends in .mmpack, else as a directory:
+    // incrementally if it is the directory we loaded from or last saved to,
+    // in full otherwise
+    SaveReport save(std::string path) {
         if (!are_sizes_matching()) {
             throw std::runtime_error("State invalid; cannot save");
         }
+        finishCompaction();
+        const uint64_t journal_sequence = journal ? journal->last_sequence() : 0;
+
+        if (is_packed_path(path)) {
+            //Windows will not rename over a mapped file, so saving back to the
+            //pack we loaded from first reads the bodies left in it and unmaps it
+            std::error_code ec;
+            if (!packed_source.empty() && fs::equivalent(path, packed_source, ec)) {
+                mm.read_all_bodies();
+                packed_source.clear();
+            }
+            LayoutPositions positions = current_layout(id_to_title, sim);
+            write_packed(path, mm, &positions);
+            return SaveReport{1, fs::file_size(path), false};
+        }
+
+        if (incremental_save && path == changes.base && fs::is_directory(path + "/Mental-Model")) {
+            SaveReport report = save_incremental(path, mm, changes, id_to_title, sim, journal_sequence);
+            changes.reset(path);
+            journal->drop_through(journal_sequence);
+            return report;
+        }
 
+        SaveReport report;
         std::string temp_path = path + ".tmp";
         std::string backup_path = path + ".bak";
 
@@ -757,38 +1090,24 @@ struct Physical_MM {
         }
         fs::create_directories(temp_path);
 
+        //The directory swap below would take the journal with it; a full save
+        //needs none of it, and the journal starts over in the new directory
+        journal.reset();
+
         try {
             // 2. Save the underlying Mental Model (mm)
             mm.save(temp_path + "/Mental-Model");
 
             // 3. Save the physics positions to physics.bin
-            std::ofstream bin(temp_path + "/physics.bin", std::ios::binary);
-            if (!bin.is_open()) {
-                throw std::runtime_error(
-                    "Failed to open physics.bin for writing.");
-            }
+            write_physics_bin(temp_path + "/physics.bin", id_to_title, sim);
+            std::ofstream(temp_path + "/" + JOURNAL_SEQUENCE_FILE) << journal_sequence << "\n";
 
-            uint64_t count = static_cast<uint64_t>(nodes.size());
-            bin.write(reinterpret_cast<const char*>(&count), sizeof(count));
-
-            for (const auto& [title, node] : nodes) {
-                // Write Title length and data
-                uint64_t len = static_cast<uint64_t>(title.size());
-                bin.write(reinterpret_cast<const char*>(&len), sizeof(len));
-                bin.write(title.data(), len);
-
-                // Write position (x, y, z) as floats
-                // We cast to float explicitly to ensure 4-byte size regardless
-                // of vec4 internal precision
-                float coords[3] = {static_cast<float>(node->position.x),
-                                   static_cast<float>(node->position.y),
-                                   static_cast<float>(node->position.z)};
-                bin.write(reinterpret_cast<const char*>(coords),
-                          sizeof(coords));
+            for (const auto& entry : fs::recursive_directory_iterator(temp_path)) {
+                if (!entry.is_regular_file()) continue;
+                report.files++;
+                report.bytes += entry.file_size();
             }
 
-            bin.close();
-
             // 4. Atomic Swap: Backup existing data, move temp to main, delete
             // backup
             if (fs::exists(path)) {
@@ -802,17 +1121,30 @@ struct Physical_MM {
                 fs::remove_all(backup_path);
             }
         } catch (...) {
-            // If anything fails during the process, clean up temp and rethrow
-            if (fs::exists(temp_path)) fs::remove_all(temp_path);
+            // If anything fails during the process, put the old directory
+            // back if it was moved aside, clean up temp and rethrow
+            std::error_code ec;
+            if (fs::exists(backup_path, ec) && !fs::exists(path, ec)) fs::rename(backup_path, path, ec);
+            fs::remove_all(temp_path, ec);
+            try {
+                if (!changes.base.empty()) openJournal(journal_sequence);
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to reopen the journal: " << e.what() << std::endl;
+            }
             throw;
         }
+
+        changes.reset(path);
+        openJournal(journal_sequence);
+        return report;
     }
 
     bool operator==(const Physical_MM& b) const {
         if (!(mm == b.mm) || nodes.size() != b.nodes.size()) return false;
-        for (auto const& [title, node_ptr] : nodes) {
+        for (auto const& [title, handle] : nodes) {
             auto it = b.nodes.find(title);
-            if (it == b.nodes.end() || !(*node_ptr == *it->second)) return false;
+            if (it == b.nodes.end() ||
+                !(position(idOf(handle)) == b.position(b.idOf(it->second)))) return false;
         }
         return true;
     }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+
+/*
+Compressed-sparse-row adjacency for an undirected edge list.
+
+The neighbours of node i are neighbours[offsets[i] .. offsets[i + 1]), and
+edges[k] is the index (into the edge list it was built from) of the edge that
+leads to neighbours[k]. Every edge therefore appears twice, once from each
+endpoint. Within a node, neighbours are listed in edge order.
+*/
+struct Adjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> neighbours;
+    std::vector<uint32_t> edges;
+
+    void build(size_t n, const std::vector<uint32_t>& edge_a, const std::vector<uint32_t>& edge_b) {
+        offsets.assign(n + 1, 0);
+        for (size_t e = 0; e < edge_a.size(); e++) {
+            offsets[edge_a[e] + 1]++;
+            offsets[edge_b[e] + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        neighbours.resize(offsets[n]);
+        edges.resize(offsets[n]);
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t e = 0; e < edge_a.size(); e++) {
+            uint32_t a = edge_a[e];
+            uint32_t b = edge_b[e];
+            neighbours[fill[a]] = b;
+            edges[fill[a]++] = e;
+            neighbours[fill[b]] = a;
+            edges[fill[b]++] = e;
+        }
+    }
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    uint32_t begin(uint32_t i) const { return offsets[i]; }
+    uint32_t end(uint32_t i) const { return offsets[i + 1]; }
+    uint32_t degree(uint32_t i) const { return offsets[i + 1] - offsets[i]; }
+
+    // Index of an edge between a and b, or -1 if there is none
+    int64_t find(uint32_t a, uint32_t b) const {
+        if (degree(b) < degree(a)) std::swap(a, b);
+        for (uint32_t k = begin(a); k < end(a); k++) {
+            if (neighbours[k] == b) return edges[k];
+        }
+        return -1;
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+
+/*
+Barnes-Hut octree for the Coulomb repulsion between nodes.
+
+The tree is rebuilt from scratch every physics step. Each cell stores the
+number of bodies below it and their centre of mass; when a cell is far enough
+away from the body being evaluated (size / distance < theta) the whole cell is
+treated as one charge sitting at its centre of mass. theta = 0 degenerates into
+the exact pairwise sum, larger values trade accuracy for speed (0.5 is the
+usual compromise). A cell holding the body itself is always opened, as its
+centre of mass includes the body; past theta ~ 0.577 the size/distance test
+alone would let such a cell through and the body would push on itself.
+
+Force convention matches Physical_MM::physics_step: a body at p_i feels
+    K * m * (p_i - p_j) / |p_i - p_j|^3
+from a charge of multiplicity m at p_j.
+*/
+struct BarnesHutTree {
+    struct Cell {
+        float cx, cy, cz;     // geometric centre
+        float half;           // half of the side length
+        float mx = 0, my = 0, mz = 0;  // centre of mass (sum until finalised)
+        uint32_t count = 0;   // bodies inside this cell
+        int32_t child = -1;   // index of the first of 8 children, -1 for leaves
+        int32_t body = -1;    // first body of a leaf, chained through next_body
+    };
+
+    // Coincident bodies would otherwise subdivide forever
+    static constexpr int MAX_DEPTH = 32;
+
+    std::vector<Cell> cells;
+    std::vector<int32_t> next_body;
+
+    const float* px = nullptr;
+    const float* py = nullptr;
+    const float* pz = nullptr;
+
+
+    void build(const float* x, const float* y, const float* z, size_t n) {
+        px = x; py = y; pz = z;
+        cells.clear();
+        next_body.assign(n, -1);
+        if (n == 0) return;
+
+        float min_x = x[0], max_x = x[0];
+        float min_y = y[0], max_y = y[0];
+        float min_z = z[0], max_z = z[0];
+        for (size_t i = 1; i < n; i++) {
+            min_x = std::min(min_x, x[i]); max_x = std::max(max_x, x[i]);
+            min_y = std::min(min_y, y[i]); max_y = std::max(max_y, y[i]);
+            min_z = std::min(min_z, z[i]); max_z = std::max(max_z, z[i]);
+        }
+
+        Cell root;
+        root.cx = 0.5f * (min_x + max_x);
+        root.cy = 0.5f * (min_y + max_y);
+        root.cz = 0.5f * (min_z + max_z);
+        root.half = 0.5f * std::max({max_x - min_x, max_y - min_y, max_z - min_z}) + 1e-3f;
+
+        cells.reserve(2 * n + 1);
+        cells.push_back(root);
+
+        for (size_t i = 0; i < n; i++) insert(static_cast<int32_t>(i));
+
+        finalise(0);
+    }
+
+    // Adds the repulsion felt by body i onto (fx, fy, fz)
+    void accumulate_repulsion(size_t i, float K, float theta,
+                              float& fx, float& fy, float& fz) const {
+        if (cells.empty()) return;
+
+        const float xi = px[i], yi = py[i], zi = pz[i];
+        const float theta_sq = theta * theta;
+
+        int32_t stack[8 * MAX_DEPTH + 8];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const Cell& cell = cells[stack[--top]];
+            if (cell.count == 0) continue;
+
+            if (cell.child == -1) {
+                for (int32_t b = cell.body; b != -1; b = next_body[b]) {
+                    if (static_cast<size_t>(b) == i) continue;
+                    add_charge(xi - px[b], yi - py[b], zi - pz[b], K, fx, fy, fz);
+                }
+                continue;
+            }
+
+            float dx = xi - cell.mx;
+            float dy = yi - cell.my;
+            float dz = zi - cell.mz;
+            float r_sq = dx * dx + dy * dy + dz * dz;
+            float size = 2.0f * cell.half;
+
+            if (size * size < theta_sq * r_sq && !contains(cell, xi, yi, zi)) {
+                add_charge(dx, dy, dz, K * cell.count, fx, fy, fz);
+            } else {
+                for (int c = 0; c < 8; c++) stack[top++] = cell.child + c;
+            }
+        }
+    }
+
+   private:
+    static bool contains(const Cell& cell, float x, float y, float z) {
+        return std::abs(x - cell.cx) <= cell.half && std::abs(y - cell.cy) <= cell.half &&
+               std::abs(z - cell.cz) <= cell.half;
+    }
+
+    static void add_charge(float dx, float dy, float dz, float K,
+                           float& fx, float& fy, float& fz) {
+        float r_sq = dx * dx + dy * dy + dz * dz;
+        float r_cubed = r_sq * std::sqrt(r_sq);
+        fx += K * dx / r_cubed;
+        fy += K * dy / r_cubed;
+        fz += K * dz / r_cubed;
+    }
+
+    int octant(const Cell& cell, int32_t b) const {
+        return (px[b] >= cell.cx ? 1 : 0) | (py[b] >= cell.cy ? 2 : 0) |
+               (pz[b] >= cell.cz ? 4 : 0);
+    }
+
+    void subdivide(int32_t index) {
+        int32_t first = static_cast<int32_t>(cells.size());
+        Cell parent = cells[index];
+        float h = parent.half * 0.5f;
+        for (int c = 0; c < 8; c++) {
+            Cell child;
+            child.cx = parent.cx + ((c & 1) ? h : -h);
+            child.cy = parent.cy + ((c & 2) ? h : -h);
+            child.cz = parent.cz + ((c & 4) ? h : -h);
+            child.half = h;
+            cells.push_back(child);
+        }
+        cells[index].child = first;
+    }
+
+    void insert(int32_t b) {
+        int32_t index = 0;
+        for (int depth = 0;; depth++) {
+            Cell& cell = cells[index];
+            cell.count++;
+
+            if (cell.child != -1) {
+                index = cell.child + octant(cell, b);
+                continue;
+            }
+
+            if (cell.body == -1) {
+                cell.body = b;
+                return;
+            }
+
+            if (depth >= MAX_DEPTH) {
+                next_body[b] = cell.body;
+                cell.body = b;
+                return;
+            }
+
+            // Occupied leaf: push the resident down one level and retry
+            int32_t resident = cell.body;
+            cell.body = -1;
+            subdivide(index);  // may reallocate, cell is invalid from here
+
+            int32_t slot = cells[index].child + octant(cells[index], resident);
+            cells[slot].body = resident;
+            cells[slot].count = 1;
+
+            index = cells[index].child + octant(cells[index], b);
+        }
+    }
+
+    void finalise(int32_t index) {
+        Cell& cell = cells[index];
+        float sx = 0, sy = 0, sz = 0;
+
+        if (cell.child == -1) {
+            for (int32_t b = cell.body; b != -1; b = next_body[b]) {
+                sx += px[b]; sy += py[b]; sz += pz[b];
+            }
+        } else {
+            for (int c = 0; c < 8; c++) {
+                finalise(cell.child + c);
+                const Cell& child = cells[cell.child + c];
+                sx += child.mx * child.count;
+                sy += child.my * child.count;
+                sz += child.mz * child.count;
+            }
+        }
+
+        Cell& done = cells[index];
+        if (done.count > 0) {
+            done.mx = sx / done.count;
+            done.my = sy / done.count;
+            done.mz = sz / done.count;
+        }
+    }
+};
@@ -0,0 +1,103 @@
+// Microbenchmark for the per-frame depth ordering in Physical_MM::render.
+//
+// "full sort" is what Object3D_Collection::depthSort does every frame:
+// compute every distance and std::sort the whole collection. DepthOrder keeps
+// last frame's order and insertion-sorts it, falling back to a radix sort.
+// Each size runs a camera at rest (an idle layout), one orbiting slowly
+// around random points, and one that jumps to a new random spot every frame.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "depth_order.hpp"
+
+struct Point {
+    float x, y, z;
+};
+
+using Item = std::pair<int, const Point*>;  // same shape as Object3D_Collection::c
+
+template <class F>
+static double time_ms(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static float distance(const Item& item, const Point& eye) {
+    float dx = item.second->x - eye.x, dy = item.second->y - eye.y, dz = item.second->z - eye.z;
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+static void full_sort(std::vector<Item>& items, const Point& eye) {
+    std::vector<std::pair<float, Item>> keyed;
+    keyed.reserve(items.size());
+    for (const Item& item : items) keyed.emplace_back(distance(item, eye), item);
+    std::sort(keyed.begin(), keyed.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = 0; i < items.size(); i++) items[i] = keyed[i].second;
+}
+
+static bool is_sorted(const std::vector<Item>& items, const Point& eye) {
+    for (size_t i = 1; i < items.size(); i++) {
+        if (distance(items[i - 1], eye) < distance(items[i], eye)) return false;
+    }
+    return true;
+}
+
+int main() {
+    const int FRAMES = 200;
+    std::printf("%8s %8s %14s %14s %8s %8s\n", "objects", "camera", "full sort", "DepthOrder",
+                "speedup", "full%");
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+
+    for (size_t n : {1000, 10000, 50000}) {
+        std::vector<Point> points(n);
+        for (Point& p : points) p = {dist(gen), dist(gen), dist(gen)};
+
+        for (const char* camera : {"still", "orbit", "jumping"}) {
+            std::vector<Point> eyes(FRAMES);
+            for (int f = 0; f < FRAMES; f++) {
+                float angle = camera[0] == 's' ? 0.0f : f * 0.01f;
+                eyes[f] = camera[0] == 'j' ? Point{dist(gen) * 3, dist(gen) * 3, dist(gen) * 3}
+                                           : Point{300 * std::cos(angle), 20, 300 * std::sin(angle)};
+            }
+
+            std::vector<Item> a(n), b(n);
+            for (size_t i = 0; i < n; i++) a[i] = b[i] = {int(i), &points[i]};
+            full_sort(a, eyes[0]);
+            b = a;
+
+            double full_ms = time_ms([&] {
+                for (int f = 0; f < FRAMES; f++) full_sort(a, eyes[f]);
+            });
+
+            DepthOrder order;
+            int fallbacks = 0;
+            double incremental_ms = time_ms([&] {
+                for (int f = 0; f < FRAMES; f++) {
+                    const Point& eye = eyes[f];
+                    order.sort(b, [&eye](const Item& item) { return distance(item, eye); });
+                    fallbacks += order.last_was_full_sort;
+                }
+            });
+
+            if (!is_sorted(b, eyes[FRAMES - 1])) {
+                std::printf("DepthOrder produced a wrong order\n");
+                return 1;
+            }
+            std::printf("%8zu %8s %12.3fms %12.3fms %7.1fx %7.0f%%\n", n, camera,
+                        full_ms / FRAMES, incremental_ms / FRAMES, full_ms / incremental_ms,
+                        100.0 * fallbacks / FRAMES);
+        }
+    }
+    return 0;
+}
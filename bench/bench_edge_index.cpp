@@ -0,0 +1,116 @@
+// Edit latency on a model with 100k connections, with MM::edge_index.
+//
+// "reference" is what the same checks cost before the index: a linear scan of
+// connections to find one, and the pairwise any_duplicate_connections that
+// validityCheck ran after every edit. An edit here is what addConnection and
+// removeConnection do to the MM: look the pair up, then connect or
+// disconnect_at, then the duplicate check.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mm.hpp"
+
+template <class F>
+static double time_ms(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static int64_t reference_find(const MM& mm, uint32_t a, uint32_t b) {
+    for (size_t i = 0; i < mm.connections.size(); i++) {
+        const Connection& c = mm.connections[i];
+        if ((c.first == a && c.second == b) || (c.first == b && c.second == a)) return i;
+    }
+    return -1;
+}
+
+static bool reference_any_duplicate(const MM& mm) {
+    const auto& connections = mm.connections;
+    for (size_t i = 0; i < connections.size(); i++) {
+        for (size_t j = i + 1; j < connections.size(); j++) {
+            if ((connections[i].first == connections[j].first && connections[i].second == connections[j].second) ||
+                (connections[i].first == connections[j].second && connections[i].second == connections[j].first)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int main() {
+    const size_t NODES = 50000, EDGES = 100000, EDITS = 10000;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> node(0, NODES - 1);
+
+    MM mm;
+    std::vector<std::string> titles;
+    for (size_t i = 0; i < NODES; i++) {
+        titles.push_back("Node " + std::to_string(i));
+        mm.nodes.emplace(titles.back(), "");
+        mm.titles.intern(titles.back());  // so that node i has id i
+    }
+    while (mm.connections.size() < EDGES) {
+        size_t a = node(gen), b = node(gen);
+        if (a != b && mm.find_connection(titles[a], titles[b]) == -1) mm.connect(titles[a], titles[b]);
+    }
+
+    //Pairs to edit: half new, half existing
+    std::vector<std::pair<size_t, size_t>> pairs;
+    for (size_t k = 0; k < EDITS; k++) {
+        if (k % 2) {
+            const Connection& c = mm.connections[node(gen) % EDGES];
+            pairs.push_back({c.first, c.second});
+        } else {
+            size_t a = node(gen), b = node(gen);
+            pairs.push_back({a, b == a ? (a + 1) % NODES : b});
+        }
+    }
+
+    std::printf("%zu nodes, %zu connections, %zu edits\n\n", NODES, mm.connections.size(), EDITS);
+
+    size_t found = 0;
+    double find_ms = time_ms([&] {
+        for (auto [a, b] : pairs) found += mm.find_connection(titles[a], titles[b]) != -1;
+    });
+
+    size_t reference_found = 0;
+    double reference_find_ms = time_ms([&] {
+        for (auto [a, b] : pairs) {
+            reference_found += reference_find(mm, mm.titles.find(titles[a]), mm.titles.find(titles[b])) != -1;
+        }
+    });
+    if (found != reference_found) {
+        std::printf("index and linear scan disagree (%zu vs %zu)\n", found, reference_found);
+        return 1;
+    }
+
+    //Toggle every pair: connect it if absent, disconnect it if present, and
+    //check for duplicates after each edit as validityCheck does
+    bool duplicates = false;
+    double edit_ms = time_ms([&] {
+        for (auto [a, b] : pairs) {
+            int64_t index = mm.find_connection(titles[a], titles[b]);
+            if (index == -1) mm.connect(titles[a], titles[b]);
+            else mm.disconnect_at(index);
+            duplicates |= mm.any_duplicate_connections();
+        }
+    });
+    bool reference_duplicates = false;
+    double reference_check_ms = time_ms([&] { reference_duplicates = reference_any_duplicate(mm); });
+    if (duplicates || reference_duplicates) {
+        std::printf("duplicate connections after editing\n");
+        return 1;
+    }
+
+    std::printf("%-32s %10.3f us\n", "find (edge_index)", 1000 * find_ms / EDITS);
+    std::printf("%-32s %10.3f us\n", "find (reference scan)", 1000 * reference_find_ms / EDITS);
+    std::printf("%-32s %10.3f us\n", "edit + duplicate check", 1000 * edit_ms / EDITS);
+    std::printf("%-32s %10.3f ms\n", "duplicate check (reference)", reference_check_ms);
+    return 0;
+}
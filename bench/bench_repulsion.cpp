@@ -0,0 +1,93 @@
+// Microbenchmark for the exact Coulomb pass in Simulation::step.
+//
+// "reference" is the loop physics_step used before the kernels: every ordered
+// pair, pow(pow(d, 2) + ..., 1.5) in double. The kernels visit each unordered
+// pair once; their forces are compared against the reference so a faster but
+// wrong kernel shows up immediately.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "repulsion_kernels.hpp"
+
+struct Forces {
+    std::vector<float> x, y, z;
+    explicit Forces(size_t n) : x(n, 0), y(n, 0), z(n, 0) {}
+};
+
+static void reference(const std::vector<float>& x, const std::vector<float>& y,
+                      const std::vector<float>& z, float K, Forces& f) {
+    size_t n = x.size();
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            if (i == j) continue;
+            float x_dist = x[i] - x[j];
+            float y_dist = y[i] - y[j];
+            float z_dist = z[i] - z[j];
+            float r_cubed = pow(pow(x_dist, 2) + pow(y_dist, 2) + pow(z_dist, 2), 1.5);
+            f.x[i] += K * x_dist / r_cubed;
+            f.y[i] += K * y_dist / r_cubed;
+            f.z[i] += K * z_dist / r_cubed;
+        }
+    }
+}
+
+static double relative_error(const Forces& a, const Forces& b) {
+    double err = 0, norm = 0;
+    for (size_t i = 0; i < a.x.size(); i++) {
+        double dx = a.x[i] - b.x[i], dy = a.y[i] - b.y[i], dz = a.z[i] - b.z[i];
+        err += dx * dx + dy * dy + dz * dz;
+        norm += double(b.x[i]) * b.x[i] + double(b.y[i]) * b.y[i] + double(b.z[i]) * b.z[i];
+    }
+    return std::sqrt(err / norm);
+}
+
+template <class F>
+static double time_ms(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+    const float K = 25.0f;
+    const repulsion::ISA best = repulsion::detect_isa();
+    std::printf("detected ISA: %s\n\n", repulsion::isa_name(best));
+    std::printf("%8s %12s %12s %12s %12s %10s\n", "nodes", "reference", "scalar",
+                "sse", "avx2", "rel.err");
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+
+    for (size_t n : {1000, 5000, 20000}) {
+        std::vector<float> x(n), y(n), z(n);
+        for (size_t i = 0; i < n; i++) {
+            x[i] = dist(gen);
+            y[i] = dist(gen);
+            z[i] = dist(gen);
+        }
+
+        Forces ref(n);
+        double ref_ms = time_ms([&] { reference(x, y, z, K, ref); });
+
+        double ms[3] = {-1, -1, -1};
+        double worst_err = 0;
+        for (repulsion::ISA isa : {repulsion::ISA::SCALAR, repulsion::ISA::SSE, repulsion::ISA::AVX2}) {
+            if (isa > best) continue;
+            Forces f(n);
+            ms[int(isa)] = time_ms([&] {
+                repulsion::run(isa, x.data(), y.data(), z.data(), n, K,
+                               f.x.data(), f.y.data(), f.z.data(), 0, n);
+            });
+            worst_err = std::max(worst_err, relative_error(f, ref));
+        }
+
+        std::printf("%8zu %10.1fms %10.1fms %10.1fms %10.1fms %10.2e\n", n, ref_ms,
+                    ms[0], ms[1], ms[2], worst_err);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+
+/*
+Back-to-front ordering (largest distance first) that exploits frame-to-frame
+coherence.
+
+The items keep last frame's order, so after a small camera or layout change
+they are often already nearly sorted (camera at rest, layout settling) and an
+insertion sort finishes in about one pass. Each insertion sort may shift at
+most moves_per_item * n elements; once that budget runs out (the camera
+moved, a fresh collection) the order is rebuilt with an LSD radix sort on the
+distance bits instead, which is O(n) as well.
+*/
+struct DepthOrder {
+    size_t moves_per_item = 4;
+
+    // How the last sort() finished, for profiling
+    bool last_was_full_sort = false;
+
+    template <class T, class DistanceOf>
+    void sort(std::vector<T>& items, DistanceOf distance_of) {
+        const size_t n = items.size();
+        distances.resize(n);
+        for (size_t i = 0; i < n; i++) distances[i] = distance_of(items[i]);
+
+        last_was_full_sort = !insertion_sort(items, moves_per_item * n);
+        if (last_was_full_sort) radix_sort(items);
+    }
+
+   private:
+    std::vector<float> distances;  // parallel to items while sorting
+    std::vector<uint32_t> keys, keys_tmp, order, order_tmp;
+
+    // Sorts items and distances together. False if the budget ran out; the
+    // two arrays are still aligned then, just not sorted.
+    template <class T>
+    bool insertion_sort(std::vector<T>& items, size_t budget) {
+        size_t moves = 0;
+        for (size_t i = 1; i < items.size(); i++) {
+            float d = distances[i];
+            if (distances[i - 1] >= d) continue;
+
+            T item = std::move(items[i]);
+            size_t j = i;
+            while (j > 0 && distances[j - 1] < d) {
+                distances[j] = distances[j - 1];
+                items[j] = std::move(items[j - 1]);
+                j--;
+            }
+            distances[j] = d;
+            items[j] = std::move(item);
+
+            moves += i - j;
+            if (moves > budget) return false;
+        }
+        return true;
+    }
+
+    // Distances are non-negative, so their IEEE bits order like unsigned
+    // integers; inverting them gives largest-first. Three stable 11-bit
+    // passes cover all 32 bits.
+    template <class T>
+    void radix_sort(std::vector<T>& items) {
+        const size_t n = items.size();
+        keys.resize(n);
+        keys_tmp.resize(n);
+        order.resize(n);
+        order_tmp.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            float d = distances[i] > 0 ? distances[i] : 0.0f;  // also folds -0 and NaN
+            uint32_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            keys[i] = ~bits;
+            order[i] = i;
+        }
+
+        for (int shift = 0; shift < 32; shift += 11) {
+            uint32_t count[2049] = {};
+            for (size_t i = 0; i < n; i++) count[((keys[i] >> shift) & 2047) + 1]++;
+            for (int b = 0; b < 2048; b++) count[b + 1] += count[b];
+            for (size_t i = 0; i < n; i++) {
+                uint32_t slot = count[(keys[i] >> shift) & 2047]++;
+                keys_tmp[slot] = keys[i];
+                order_tmp[slot] = order[i];
+            }
+            keys.swap(keys_tmp);
+            order.swap(order_tmp);
+        }
+
+        std::vector<T> sorted;
+        sorted.reserve(n);
+        for (uint32_t i : order) sorted.push_back(std::move(items[i]));
+        items.swap(sorted);
+    }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+
+#include <SFML/Graphics.hpp>
+#include <sfml-3d/3d_camera.hpp>
+#include <sfml-3d/math4.hpp>
+
+
+/*
+Lets the main loop skip frames that would look exactly like the last one.
+
+After each iteration the loop reports whether anything on screen can have
+changed (an event came in, the camera moved, physics delivered positions,
+the GUI has an animation or blinking cursor running). If nothing did, the
+next iteration blocks in waitEvent instead of polling, for at most
+idle_timeout so work finishing in the background is still picked up. While
+things change, frames are paced by the window's frame rate limit.
+*/
+struct FramePacer {
+    sf::Time idle_timeout = sf::milliseconds(250);
+    bool idle = false;  // the last iteration drew nothing
+
+    // First event of the iteration, waiting for one if we are idle
+    std::optional<sf::Event> first_event(sf::RenderWindow& window) const {
+        return idle ? window.waitEvent(idle_timeout) : window.pollEvent();
+    }
+
+    // Compares the camera frame with the one seen on the previous call
+    bool camera_moved(const Camera& camera) {
+        //Eye, a point ahead and a point above: enough to catch any move or turn
+        const vec4 points[3] = {camera.cf * vec4(0, 0, 0), camera.cf * vec4(0, 0, 1),
+                                camera.cf * vec4(0, 1, 0)};
+        bool moved = false;
+        for (int k = 0; k < 3; k++) {
+            moved |= !(points[k] == last_camera[k]);
+            last_camera[k] = points[k];
+        }
+        return moved;
+    }
+
+   private:
+    vec4 last_camera[3];
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+
+/*
+Per-frame timings of the main loop, kept for the last HISTORY frames.
+
+The loop calls lap(phase) at the end of every phase, which charges the time
+since the previous lap (or begin_frame) to that phase, and end_frame() once
+the frame is presented. A phase that is lapped several times in a frame adds
+up. Besides the timings every frame records a few counts (objects, what was
+drawn, draw calls) so a slow frame can be matched to what was on screen.
+
+The overlay (toggled with F3 in main.cpp) shows min/avg/p99 per phase over
+the history; write_csv dumps the history itself, oldest frame first.
+*/
+struct FrameProfiler {
+    enum Phase {
+        EVENTS,   // pollEvent, camera and GUI event handling
+        CAMERA,   // camera.update
+        PHYSICS,  // physics_step: polling the simulation thread and copying positions
+        SORT,     // window.clear and the depth sort of the collection
+        CULL,     // cullScene
+        PICKING,  // picking grid and hover test
+        DRAW,     // drawScene
+        GUI,      // overlay lines and gui.draw
+        PRESENT,  // crosshair, this overlay and window.display
+        PHASE_COUNT
+    };
+    static constexpr const char* PHASE_NAMES[PHASE_COUNT] = {
+        "events", "camera", "physics", "sort", "cull", "picking", "draw", "gui", "present"};
+
+    struct Counts {
+        uint32_t nodes = 0, connections = 0;
+        uint32_t nodes_drawn = 0, edges_drawn = 0, labels_drawn = 0;
+        uint32_t draw_calls = 0;
+        uint32_t awake = 0;  // nodes the simulation is still integrating
+    };
+
+    struct Frame {
+        std::array<float, PHASE_COUNT> ms{};
+        float total_ms = 0;
+        Counts counts;
+    };
+
+    struct Stats {
+        float min = 0, avg = 0, p99 = 0;
+    };
+
+    static constexpr size_t HISTORY = 600;
+
+    bool visible = false;
+
+    void begin_frame() {
+        current = Frame();
+        frame_start = last_lap = Clock::now();
+    }
+
+    void lap(Phase phase) {
+        auto now = Clock::now();
+        current.ms[phase] += std::chrono::duration<float, std::milli>(now - last_lap).count();
+        last_lap = now;
+    }
+
+    void end_frame(const Counts& counts) {
+        current.total_ms = std::chrono::duration<float, std::milli>(Clock::now() - frame_start).count();
+        current.counts = counts;
+        if (frames.size() < HISTORY) {
+            frames.push_back(current);
+        } else {
+            frames[next] = current;
+        }
+        next = (next + 1) % HISTORY;
+        frame_count++;
+    }
+
+    size_t size() const { return frames.size(); }
+
+    // Frame `k` of the history, 0 being the oldest
+    const Frame& at(size_t k) const {
+        return frames.size() < HISTORY ? frames[k] : frames[(next + k) % HISTORY];
+    }
+
+    // Over the whole history; phase == PHASE_COUNT gives the frame total
+    Stats stats(int phase) const {
+        Stats s;
+        if (frames.empty()) return s;
+
+        scratch.clear();
+        for (const Frame& f : frames) scratch.push_back(phase == PHASE_COUNT ? f.total_ms : f.ms[phase]);
+        double sum = 0;
+        for (float v : scratch) sum += v;
+        s.avg = float(sum / scratch.size());
+        s.min = *std::min_element(scratch.begin(), scratch.end());
+        auto p99 = scratch.begin() + (scratch.size() - 1) * 99 / 100;
+        std::nth_element(scratch.begin(), p99, scratch.end());
+        s.p99 = *p99;
+        return s;
+    }
+
+    void write_csv(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file) throw std::runtime_error("Cannot write " + path);
+
+        file << "frame";
+        for (const char* name : PHASE_NAMES) file << ',' << name << "_ms";
+        file << ",total_ms,nodes,connections,nodes_drawn,edges_drawn,labels_drawn,draw_calls,awake\n";
+
+        const size_t first = frame_count - frames.size();
+        for (size_t k = 0; k < frames.size(); k++) {
+            const Frame& f = at(k);
+            file << first + k;
+            for (float ms : f.ms) file << ',' << ms;
+            const Counts& c = f.counts;
+            file << ',' << f.total_ms << ',' << c.nodes << ',' << c.connections << ',' << c.nodes_drawn
+                 << ',' << c.edges_drawn << ',' << c.labels_drawn << ',' << c.draw_calls << ','
+                 << c.awake << '\n';
+        }
+        if (!file) throw std::runtime_error("Failed writing " + path);
+    }
+
+    // Table in the top left corner of the window, if visible
+    void draw(sf::RenderTarget& target, const sf::Font& font) const {
+        if (!visible || frames.empty()) return;
+
+        std::string table;
+        char line[128];
+        std::snprintf(line, sizeof line, "%-8s %7s %7s %7s  (ms, last %zu frames)\n", "phase", "min",
+                      "avg", "p99", frames.size());
+        table += line;
+        for (int p = 0; p <= PHASE_COUNT; p++) {
+            Stats s = stats(p);
+            std::snprintf(line, sizeof line, "%-8s %7.2f %7.2f %7.2f\n",
+                          p == PHASE_COUNT ? "frame" : PHASE_NAMES[p], s.min, s.avg, s.p99);
+            table += line;
+        }
+
+        const Counts& c = at(frames.size() - 1).counts;
+        std::snprintf(line, sizeof line, "\nnodes %u (%u drawn, %u awake)\nconnections %u (%u drawn)\n",
+                      c.nodes, c.nodes_drawn, c.awake, c.connections, c.edges_drawn);
+        table += line;
+        std::snprintf(line, sizeof line, "labels %u, draw calls %u\nF4: dump to CSV", c.labels_drawn,
+                      c.draw_calls);
+        table += line;
+
+        sf::Text text(font, table, CHARACTER_SIZE);
+        text.setFillColor(sf::Color::White);
+        text.setPosition(sf::Vector2f(MARGIN, MARGIN));
+
+        sf::FloatRect bounds = text.getGlobalBounds();
+        sf::RectangleShape background(bounds.size + sf::Vector2f(2 * MARGIN, 2 * MARGIN));
+        background.setPosition(bounds.position - sf::Vector2f(MARGIN, MARGIN));
+        background.setFillColor(sf::Color(0, 0, 0, 180));
+
+        target.draw(background);
+        target.draw(text);
+    }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr unsigned CHARACTER_SIZE = 16;
+    static constexpr float MARGIN = 8;
+
+    std::vector<Frame> frames;  // ring buffer once full; `next` is the oldest
+    size_t next = 0;
+    size_t frame_count = 0;
+
+    Frame current;
+    Clock::time_point frame_start, last_lap;
+
+    mutable std::vector<float> scratch;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <SFML/Graphics.hpp>
+
+
+/*
+All sphere impostors and connection lines of a frame in one triangle list,
+drawn with a single draw call. Shapes are appended in painter's order (far
+to near) and keep that order inside the batch, so occlusion is the same as
+drawing them one by one. Colours are per vertex.
+*/
+struct GeometryBatch {
+    void clear() { triangles.clear(); }
+
+    size_t vertex_count() const { return triangles.getVertexCount(); }
+
+    // Screen-space quad from a to b, `width` pixels wide
+    void add_segment(sf::Vector2f a, sf::Vector2f b, float width, sf::Color color) {
+        sf::Vector2f d = b - a;
+        float length = std::sqrt(d.x * d.x + d.y * d.y);
+        if (length <= 0) return;
+        sf::Vector2f n(-d.y / length * width * 0.5f, d.x / length * width * 0.5f);
+
+        add_triangle(a + n, b + n, b - n, color);
+        add_triangle(a + n, b - n, a - n, color);
+    }
+
+    // Flat disc standing in for a sphere; more segments the bigger it is
+    void add_disc(sf::Vector2f centre, float radius, sf::Color color) {
+        if (radius <= 0) return;
+        const int segments = std::clamp(int(radius), 6, 48);
+        const float step = 6.2831853f / segments;
+        const float c = std::cos(step), s = std::sin(step);
+
+        //Rotate the rim offset by one segment at a time
+        sf::Vector2f offset(radius, 0);
+        for (int k = 0; k < segments; k++) {
+            sf::Vector2f next(offset.x * c - offset.y * s, offset.x * s + offset.y * c);
+            add_triangle(centre, centre + offset, centre + next, color);
+            offset = next;
+        }
+    }
+
+    void draw(sf::RenderTarget& target) const {
+        if (vertex_count() > 0) target.draw(triangles);
+    }
+
+   private:
+    sf::VertexArray triangles{sf::PrimitiveType::Triangles};
+
+    void add_triangle(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Color color) {
+        triangles.append(sf::Vertex{a, color});
+        triangles.append(sf::Vertex{b, color});
+        triangles.append(sf::Vertex{c, color});
+    }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+/*
+Generational handles for objects kept in dense, swap-and-pop arrays.
+
+A handle names a slot; the slot records where its object currently sits in
+the dense array and a generation that is bumped whenever the slot is freed,
+so a handle to a removed object stops resolving even after its slot has been
+reused. Tag only keeps node and edge handles from mixing.
+*/
+template <class Tag>
+struct Handle {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t slot = NONE;
+    uint32_t generation = 0;
+
+    bool is_none() const { return slot == NONE; }
+    bool operator==(const Handle&) const = default;
+};
+
+
+template <class Tag>
+struct HandleTable {
+    using Key = Handle<Tag>;
+
+    // Registers an object appended to the dense arrays
+    Key insert() {
+        const uint32_t index = owners.size();
+        uint32_t slot;
+        if (free_slots.empty()) {
+            slot = slots.size();
+            slots.push_back({index, 0, true});
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+            slots[slot].index = index;
+            slots[slot].live = true;
+        }
+        owners.push_back({slot, slots[slot].generation});
+        return owners.back();
+    }
+
+    // Frees the handle of the object at dense position `index`, swap-and-pops
+    // `owners` like the dense arrays themselves and returns the handle that
+    // now lives at `index` (none if it was the last)
+    Key remove(uint32_t index) {
+        Key removed = owners[index];
+        Slot& slot = slots[removed.slot];
+        slot.live = false;
+        slot.generation++;
+        free_slots.push_back(removed.slot);
+
+        Key moved;
+        if (index + 1 != owners.size()) {
+            moved = owners.back();
+            owners[index] = moved;
+            slots[moved.slot].index = index;
+        }
+        owners.pop_back();
+        return moved;
+    }
+
+    bool valid(Key key) const {
+        return key.slot < slots.size() && slots[key.slot].live &&
+               slots[key.slot].generation == key.generation;
+    }
+
+    uint32_t index(Key key) const {
+        assert(valid(key));
+        return slots[key.slot].index;
+    }
+
+    Key at(uint32_t index) const { return owners[index]; }
+
+    // For code that stores bare slot numbers of live objects
+    Key key_of_slot(uint32_t slot) const { return {slot, slots[slot].generation}; }
+    uint32_t index_of_slot(uint32_t slot) const { return slots[slot].index; }
+
+    size_t size() const { return owners.size(); }
+
+    void clear() {
+        slots.clear();
+        free_slots.clear();
+        owners.clear();
+    }
+
+   private:
+    struct Slot {
+        uint32_t index;
+        uint32_t generation;
+        bool live;
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<Key> owners;  // dense position -> handle
+};
+
+
+// Moves the last element into `index` and drops the last slot, the way the
+// dense arrays behind a HandleTable are kept
+template <class T>
+void swap_and_pop(std::vector<T>& v, size_t index) {
+    if (index + 1 != v.size()) v[index] = std::move(v.back());
+    v.pop_back();
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mm.hpp"
+#include "physics.hpp"
+#include "physics_bin.hpp"
+
+
+/*
+Incremental save of a model directory (Mental-Model/ plus physics.bin).
+
+ModelChanges records, since the directory was last loaded or fully saved,
+which node files have to be rewritten, which have to go, and whether
+CONNECTIONS.txt has to be rewritten. save_incremental then writes only
+those, plus physics.bin and journal.seq.
+
+Crash safety, without touching Mental-Model/ until everything is on disk:
+1. The files are written into <model>/save.staging/, together with a MANIFEST
+   listing the moves and deletions, all as paths relative to <model>.
+2. save.staging is renamed to save.commit. That rename is the commit point:
+   before it the old model is intact and the staging directory is garbage,
+   after it the save counts as done.
+3. The manifest is applied (staged files renamed over the old ones, deleted
+   titles removed) and save.commit is removed.
+Every staged file and the staging directory are fsynced before the rename,
+and Mental-Model/ and the model directory after the manifest is applied, so
+that a save is on disk before anything (like the journal) relies on it.
+A crash during 3 leaves save.commit behind, and recover_incremental_save,
+called before loading, applies it again; every step of it can be repeated.
+*/
+struct ModelChanges {
+    std::string base;                // directory the changes are relative to
+    std::set<std::string> written;   // titles whose file must be (re)written
+    std::set<std::string> deleted;   // titles whose file must go
+    bool connections = false;        // CONNECTIONS.txt must be rewritten
+
+    void reset(const std::string& directory) {
+        base = directory;
+        written.clear();
+        deleted.clear();
+        connections = false;
+    }
+
+    void node_written(const std::string& title) {
+        written.insert(title);
+        deleted.erase(title);
+    }
+
+    void node_deleted(const std::string& title) {
+        written.erase(title);
+        deleted.insert(title);
+    }
+
+    // Adds changes made after these
+    void merge(const ModelChanges& later) {
+        for (const std::string& title : later.written) node_written(title);
+        for (const std::string& title : later.deleted) node_deleted(title);
+        connections |= later.connections;
+    }
+};
+
+struct SaveReport {
+    size_t files = 0;
+    uint64_t bytes = 0;
+    bool incremental = false;
+};
+
+// Flushes a file, or on POSIX a directory (so that renames and deletions in
+// it last); Windows cannot flush a directory and commits its metadata itself
+inline void sync_path(const fs::path& path) {
+#ifdef _WIN32
+    if (fs::is_directory(path)) return;
+    int fd = _wopen(path.c_str(), _O_RDWR | _O_BINARY);
+    bool ok = fd != -1 && _commit(fd) == 0;
+    if (fd != -1) _close(fd);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    bool ok = fd != -1 && fsync(fd) == 0;
+    if (fd != -1) ::close(fd);
+#endif
+    if (!ok) throw std::runtime_error("Failed to flush " + path.string());
+}
+
+const std::string SAVE_STAGING_DIR = "save.staging";
+const std::string SAVE_COMMIT_DIR = "save.commit";
+
+// Finishes a committed incremental save and drops an uncommitted one
+inline void recover_incremental_save(const std::string& path) {
+    const fs::path root(path);
+    const fs::path commit = root / SAVE_COMMIT_DIR;
+    if (fs::exists(root / SAVE_STAGING_DIR)) fs::remove_all(root / SAVE_STAGING_DIR);
+    if (!fs::exists(commit)) return;
+
+    std::ifstream manifest(commit / "MANIFEST");
+    if (!manifest.is_open()) throw std::runtime_error("Incomplete save in " + commit.string());
+
+    std::vector<std::string> moves, deletions;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        (line.compare(0, tab, "move") == 0 ? moves : deletions).push_back(line.substr(tab + 1));
+    }
+
+    for (const std::string& file : moves) {
+        //Already moved if a previous attempt got this far
+        if (fs::exists(commit / file)) fs::rename(commit / file, root / file);
+    }
+    for (const std::string& file : deletions) {
+        //On case-insensitive file systems a rename that only changes case
+        //moved the new file onto the one to delete; it stays
+        std::error_code ec;
+        bool rewritten = false;
+        for (const std::string& moved : moves) rewritten |= fs::equivalent(root / moved, root / file, ec);
+        if (!rewritten) fs::remove(root / file);
+        assert((rewritten || !fs::exists(root / file)) && "Deleted file survived the save.");
+    }
+    sync_path(root / "Mental-Model");
+    sync_path(root);
+    fs::remove_all(commit);
+}
+
+// What an incremental save writes, copied out of the model so that it can be
+// written on another thread while editing goes on
+struct SaveSnapshot {
+    std::vector<std::pair<std::string, std::string>> files;  // path relative to the model, contents
+    std::vector<std::string> deleted;                        // path relative to the model
+    LayoutPositions layout;
+    uint64_t journal_sequence = 0;  // last journal record the save includes (see journal.hpp)
+};
+
+const std::string JOURNAL_SEQUENCE_FILE = "journal.seq";
+
+// The files `changes` lists, as they are in `mm`. titles[i] is the title of
+// simulation node i.
+inline SaveSnapshot snapshot_changes(const MM& mm, const ModelChanges& changes,
+                                     const std::vector<std::string>& titles, const Simulation& sim,
+                                     uint64_t journal_sequence) {
+    SaveSnapshot snapshot;
+    for (const std::string& title : changes.written) {
+        if (mm.nodes.contains(title)) snapshot.files.emplace_back("Mental-Model/" + title + ".txt", mm.body(title));
+    }
+    if (changes.connections) {
+        std::string text;
+        for (const auto& [a, b] : mm.connections) text += mm.title(a) + "\t" + mm.title(b) + "\n";
+        snapshot.files.emplace_back("Mental-Model/CONNECTIONS.txt", std::move(text));
+    }
+    for (const std::string& title : changes.deleted) {
+        if (!mm.nodes.contains(title)) snapshot.deleted.push_back("Mental-Model/" + title + ".txt");
+    }
+    snapshot.layout = current_layout(titles, sim);
+    snapshot.journal_sequence = journal_sequence;
+    return snapshot;
+}
+
+// Writes `snapshot` into the model directory at `path`, which must hold the
+// model it was taken relative to
+inline SaveReport write_snapshot(const std::string& path, const SaveSnapshot& snapshot) {
+    recover_incremental_save(path);
+
+    const fs::path root(path);
+    const fs::path staging = root / SAVE_STAGING_DIR;
+    fs::create_directories(staging / "Mental-Model");
+
+    SaveReport report;
+    report.incremental = true;
+    std::ofstream manifest(staging / "MANIFEST");
+    if (!manifest.is_open()) throw std::runtime_error("Failed to open " + (staging / "MANIFEST").string());
+
+    auto stage = [&](const std::string& relative, const std::string& contents) {
+        std::ofstream file(staging / relative);
+        if (!file.is_open()) throw std::runtime_error("Failed to open file for " + relative);
+        file << contents;
+        file.close();
+        if (!file) throw std::runtime_error("Failed to write " + relative);
+        sync_path(staging / relative);
+        manifest << "move\t" << relative << "\n";
+        report.files++;
+        report.bytes += contents.size();
+    };
+
+    try {
+        for (const auto& [relative, contents] : snapshot.files) stage(relative, contents);
+        stage(JOURNAL_SEQUENCE_FILE, std::to_string(snapshot.journal_sequence) + "\n");
+
+        write_physics_bin((staging / "physics.bin").string(), snapshot.layout);
+        sync_path(staging / "physics.bin");
+        manifest << "move\tphysics.bin\n";
+        report.files++;
+        report.bytes += fs::file_size(staging / "physics.bin");
+
+        for (const std::string& relative : snapshot.deleted) manifest << "delete\t" << relative << "\n";
+
+        manifest.close();
+        if (!manifest) throw std::runtime_error("Failed to write the save manifest");
+        sync_path(staging / "MANIFEST");
+        sync_path(staging / "Mental-Model");
+        sync_path(staging);
+    } catch (...) {
+        fs::remove_all(staging);
+        throw;
+    }
+
+    fs::rename(staging, root / SAVE_COMMIT_DIR);
+    sync_path(root);
+    recover_incremental_save(path);
+    return report;
+}
+
+// Writes what `changes` lists into the model directory at `path`, which must
+// hold the model the changes are relative to
+inline SaveReport save_incremental(const std::string& path, const MM& mm, const ModelChanges& changes,
+                                   const std::vector<std::string>& titles, const Simulation& sim,
+                                   uint64_t journal_sequence = 0) {
+    return write_snapshot(path, snapshot_changes(mm, changes, titles, sim, journal_sequence));
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "incremental_save.hpp"
+#include "mm.hpp"
+#include "physics_bin.hpp"
+
+
+/*
+Append-only journal of model edits, kept next to Mental-Model as
+journal.log, so edits survive a crash without saving the whole model.
+
+Every edit is one record with a sequence number:
+
+    uint32 payload size
+    payload: uint64 sequence, uint8 op, uint8 argument count,
+             per argument uint32 size and bytes
+    uint32 FNV-1a checksum of the payload
+
+Records are buffered and written by a background thread every
+commit_interval, one fsync per batch (group commit). A body edit replaces a
+body edit of the same node that is still waiting in the buffer, so typing
+does not queue one copy of the body per keystroke.
+
+journal.seq holds the sequence number of the last edit included in the
+saved model; it is written with every save (see incremental_save.hpp).
+load_model_directory replays the records after it on top of the saved model
+and cuts off a torn record at the end (from a crash mid-write). Once the journal has
+grown past a size threshold Physical_MM saves in the background and
+drop_through() then removes the records that save covered.
+*/
+enum class JournalOp : uint8_t {
+    ADD_NODE = 1,       // title, body, position (3 floats)
+    REMOVE_NODE,        // title
+    RENAME_NODE,        // old title, new title
+    SET_BODY,           // title, body
+    ADD_CONNECTION,     // first, second
+    REMOVE_CONNECTION,  // first, second
+};
+
+struct JournalRecord {
+    uint64_t sequence;
+    JournalOp op;
+    std::vector<std::string> args;
+};
+
+const std::string JOURNAL_FILE = "journal.log";
+
+inline uint32_t fnv1a(std::string_view bytes) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 0 if the model has no journal.seq
+inline uint64_t read_journal_sequence(const std::string& path) {
+    std::ifstream file(fs::path(path) / JOURNAL_SEQUENCE_FILE);
+    uint64_t sequence = 0;
+    if (file.is_open()) file >> sequence;
+    return sequence;
+}
+
+// Records of the journal at `path` in file order. Stops at the first record
+// that is cut off or fails its checksum; returns the size of the valid part.
+inline uint64_t read_journal(const std::string& path, std::vector<JournalRecord>& records) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return 0;
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t at = 0;
+    auto read_u32 = [&data](size_t offset) {
+        uint32_t v;
+        std::memcpy(&v, data.data() + offset, sizeof(v));
+        return v;
+    };
+
+    while (at + 4 <= data.size()) {
+        const uint32_t size = read_u32(at);
+        if (size < 10 || at + 4 + size + 4 > data.size()) break;
+        std::string_view payload(data.data() + at + 4, size);
+        if (fnv1a(payload) != read_u32(at + 4 + size)) break;
+
+        JournalRecord record;
+        std::memcpy(&record.sequence, payload.data(), sizeof(record.sequence));
+        record.op = JournalOp(payload[8]);
+        const size_t count = uint8_t(payload[9]);
+        size_t p = 10;
+        bool ok = true;
+        for (size_t k = 0; k < count && ok; k++) {
+            uint32_t len;
+            ok = p + 4 <= payload.size();
+            if (!ok) break;
+            std::memcpy(&len, payload.data() + p, sizeof(len));
+            p += 4;
+            ok = len <= payload.size() - p;
+            if (ok) record.args.emplace_back(payload.substr(p, len));
+            p += len;
+        }
+        if (!ok) break;
+
+        records.push_back(std::move(record));
+        at += 4 + size + 4;
+    }
+    return at;
+}
+
+// Applies one record to `mm` the way Physical_MM made the edit, including
+// the position a removed connection leaves to the last one, and keeps
+// `layout` following added, renamed and removed nodes. Records that do not
+// fit the model (e.g. replayed twice) are skipped; returns whether it applied.
+inline bool apply_journal_record(MM& mm, LayoutPositions& layout, ModelChanges& changes,
+                                 const JournalRecord& record) {
+    const auto& args = record.args;
+    auto remove_connection = [&mm, &changes](size_t index) {
+        mm.disconnect_at(index);
+        changes.connections = true;
+    };
+
+    switch (record.op) {
+        case JournalOp::ADD_NODE: {
+            if (args.size() != 3 || args[2].size() != sizeof(float) * 3 || mm.nodes.contains(args[0])) return false;
+            mm.nodes[args[0]] = args[1];
+            changes.node_written(args[0]);
+            std::array<float, 3> position;
+            std::memcpy(position.data(), args[2].data(), sizeof(position));
+            layout[args[0]] = position;
+            return true;
+        }
+
+        case JournalOp::REMOVE_NODE:
+            if (args.size() != 1 || !mm.nodes.contains(args[0])) return false;
+            for (size_t i = mm.connections.size(), id = mm.titles.find(args[0]); i-- > 0;) {
+                if (mm.connections[i].first == id || mm.connections[i].second == id) remove_connection(i);
+            }
+            mm.erase_node(args[0]);
+            layout.erase(args[0]);
+            changes.node_deleted(args[0]);
+            return true;
+
+        case JournalOp::RENAME_NODE:
+            if (args.size() != 2 || !mm.nodes.contains(args[0]) || mm.nodes.contains(args[1])) return false;
+            mm.rename_node(args[0], args[1]);
+            if (auto it = layout.find(args[0]); it != layout.end()) {
+                layout[args[1]] = it->second;
+                layout.erase(args[0]);
+            }
+            changes.node_deleted(args[0]);
+            changes.node_written(args[1]);
+            //The connections keep the id, but CONNECTIONS.txt has the title
+            for (const Connection& connection : mm.connections) {
+                if (mm.title(connection.first) == args[1] || mm.title(connection.second) == args[1]) {
+                    changes.connections = true;
+                    break;
+                }
+            }
+            return true;
+
+        case JournalOp::SET_BODY:
+            if (args.size() != 2 || !mm.nodes.contains(args[0])) return false;
+            mm.set_body(args[0], args[1]);
+            changes.node_written(args[0]);
+            return true;
+
+        case JournalOp::ADD_CONNECTION:
+            if (args.size() != 2 || !mm.nodes.contains(args[0]) || !mm.nodes.contains(args[1]) ||
+                mm.find_connection(args[0], args[1]) != -1) {
+                return false;
+            }
+            mm.connect(args[0], args[1]);
+            changes.connections = true;
+            return true;
+
+        case JournalOp::REMOVE_CONNECTION: {
+            if (args.size() != 2) return false;
+            int64_t index = mm.find_connection(args[0], args[1]);
+            if (index == -1) return false;
+            remove_connection(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+// A model directory as it was last edited: the saved model with the edits in
+// its journal replayed on top, and those edits as changes still to be saved
+struct ModelDirectory {
+    MM mm;
+    LayoutPositions layout;
+    ModelChanges changes;
+    uint64_t journal_sequence = 0;  // last record applied or included in the save
+    size_t replayed = 0;
+};
+
+// Also finishes an interrupted save and cuts a torn record off the journal,
+// so that new records can be appended after the valid ones. With lazy_bodies
+// the bodies are read when first asked for (MM::lazy).
+inline ModelDirectory load_model_directory(const std::string& path, bool lazy_bodies = false) {
+    recover_incremental_save(path);
+
+    ModelDirectory model;
+    model.mm = lazy_bodies ? MM::lazy(path + "/Mental-Model") : MM(path + "/Mental-Model");
+    // A missing physics.bin leaves every node to MultilevelLayout
+    read_physics_bin(path + "/physics.bin", model.layout);
+    model.changes.reset(path);
+    model.journal_sequence = read_journal_sequence(path);
+
+    const std::string journal = (fs::path(path) / JOURNAL_FILE).string();
+    std::vector<JournalRecord> records;
+    const uint64_t valid = read_journal(journal, records);
+    if (fs::exists(journal) && fs::file_size(journal) != valid) fs::resize_file(journal, valid);
+
+    for (const JournalRecord& record : records) {
+        if (record.sequence <= model.journal_sequence) continue;
+        model.journal_sequence = record.sequence;
+        model.replayed += apply_journal_record(model.mm, model.layout, model.changes, record);
+    }
+    return model;
+}
+
+
+struct Journal {
+    std::chrono::milliseconds commit_interval{100};
+
+    // Appends to <dir>/journal.log, numbering new records from next_sequence
+    Journal(const std::string& dir, uint64_t next_sequence)
+        : path((fs::path(dir) / JOURNAL_FILE).string()), next(next_sequence) {
+        if (!open()) throw std::runtime_error("Failed to open " + path);
+        writer = std::thread([this] { writer_loop(); });
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    ~Journal() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        sync();
+        if (file) std::fclose(file);
+    }
+
+    // Returns the record's sequence number
+    uint64_t append(JournalOp op, std::initializer_list<std::string_view> args) {
+        std::string payload(10, '\0');
+        for (std::string_view arg : args) {
+            uint32_t len = arg.size();
+            payload.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            payload.append(arg);
+        }
+        payload[8] = char(op);
+        payload[9] = char(args.size());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t sequence = next++;
+        std::memcpy(payload.data(), &sequence, sizeof(sequence));
+
+        //A body edit right after one of the same node supersedes it
+        if (op == JournalOp::SET_BODY && last_pending_op == JournalOp::SET_BODY &&
+            last_pending_title == *args.begin()) {
+            pending.resize(last_pending_offset);
+        }
+        last_pending_offset = pending.size();
+        last_pending_op = op;
+        last_pending_title = *args.begin();
+
+        uint32_t size = payload.size();
+        uint32_t checksum = fnv1a(payload);
+        pending.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        pending += payload;
+        pending.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+        return sequence;
+    }
+
+    // Sequence number of the last record appended
+    uint64_t last_sequence() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return next - 1;
+    }
+
+    // On disk plus still buffered
+    uint64_t size_bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return file_bytes + pending.size();
+    }
+
+    // Writes and fsyncs everything appended so far
+    void sync() {
+        std::lock_guard<std::mutex> file_lock(file_mutex);
+        write_pending();
+    }
+
+    // Removes the records up to and including `sequence`, once a save holds them
+    void drop_through(uint64_t sequence) {
+        std::lock_guard<std::mutex> file_lock(file_mutex);
+        write_pending();
+
+        std::vector<JournalRecord> records;
+        const uint64_t valid = read_journal(path, records);
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        data.resize(std::min<uint64_t>(valid, data.size()));
+
+        //Records are in sequence order, so the ones to keep are a suffix
+        size_t at = 0;
+        for (const JournalRecord& record : records) {
+            if (record.sequence > sequence) break;
+            uint32_t size;
+            std::memcpy(&size, data.data() + at, sizeof(size));
+            at += 4 + size + 4;
+        }
+
+        const std::string temp = path + ".tmp";
+        FILE* out = std::fopen(temp.c_str(), "wb");
+        if (!out) throw std::runtime_error("Failed to open " + temp);
+        std::fwrite(data.data() + at, 1, data.size() - at, out);
+        bool ok = std::fflush(out) == 0 && sync_file(out);
+        ok &= std::fclose(out) == 0;
+        if (!ok) {
+            fs::remove(temp);
+            throw std::runtime_error("Failed to write " + temp);
+        }
+
+        //Whatever fails from here, `file` is reopened on whichever journal is
+        //at `path` then, the old one or the new one
+        if (file) std::fclose(file);
+        file = nullptr;
+        try {
+            fs::rename(temp, path);
+            sync_path(fs::path(path).parent_path());
+        } catch (...) {
+            open();
+            throw;
+        }
+        if (!open()) throw std::runtime_error("Failed to open " + path);
+    }
+
+   private:
+    std::string path;
+    FILE* file = nullptr;
+    std::thread writer;
+
+    std::mutex file_mutex;  // taken before mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    uint64_t next;
+    std::string pending;
+    uint64_t file_bytes = 0;
+    size_t last_pending_offset = 0;
+    JournalOp last_pending_op{};
+    std::string last_pending_title;
+
+    static bool sync_file(FILE* f) {
+#ifdef _WIN32
+        return _commit(_fileno(f)) == 0;
+#else
+        return fsync(fileno(f)) == 0;
+#endif
+    }
+
+    // With file_mutex held (or before the writer starts). On failure `file`
+    // stays null and write_pending tries again.
+    bool open() {
+        file = std::fopen(path.c_str(), "ab");
+        if (!file) return false;
+        std::error_code ec;
+        auto size = fs::file_size(path, ec);
+        std::lock_guard<std::mutex> lock(mutex);
+        file_bytes = ec ? 0 : size;
+        return true;
+    }
+
+    // With file_mutex held. Without a file, or if writing fails, the records
+    // stay buffered and the next call tries again.
+    void write_pending() {
+        if (!file && !open()) {
+            std::fprintf(stderr, "Journal: failed to open %s\n", path.c_str());
+            return;
+        }
+        std::string batch;
+        uint64_t good_bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.swap(pending);
+            last_pending_op = JournalOp{};
+            good_bytes = file_bytes;
+        }
+        if (batch.empty()) return;
+        bool ok = std::fwrite(batch.data(), 1, batch.size(), file) == batch.size();
+        ok = ok && std::fflush(file) == 0 && sync_file(file);
+        if (ok) {
+            std::lock_guard<std::mutex> lock(mutex);
+            file_bytes += batch.size();
+            return;
+        }
+
+        //Cut off whatever part of the batch reached the file, so that it is
+        //not followed by a torn record when written again
+        std::fprintf(stderr, "Journal: failed to write %s\n", path.c_str());
+        std::fclose(file);
+        file = nullptr;
+        std::error_code ec;
+        fs::resize_file(path, good_bytes, ec);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert(0, batch);
+        if (last_pending_op != JournalOp{}) last_pending_offset += batch.size();
+    }
+
+    void writer_loop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait_for(lock, commit_interval, [this] { return stopping; });
+                if (stopping) return;
+            }
+            sync();
+        }
+    }
+};
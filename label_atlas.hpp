@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+
+/*
+Rasterises every label title once into shared atlas pages and draws labels
+as textured quads, one draw call per page.
+
+Titles are packed in shelves (rows as tall as their tallest entry) onto
+PAGE_SIZE square render textures, in white so the quad's vertex colour tints
+them. An entry stays until forget() drops it (e.g. on rename); the space it
+used is only reclaimed once enough has been forgotten, by dropping every page
+and letting the titles still in use be rasterised again on demand.
+*/
+struct LabelAtlas {
+    static constexpr unsigned PAGE_SIZE = 2048;
+    static constexpr unsigned PADDING = 2;
+
+    struct Entry {
+        size_t page;
+        sf::IntRect rect;  // pixels on the page
+    };
+
+    LabelAtlas(const sf::Font& font, unsigned character_size)
+        : font(font), character_size(character_size) {}
+
+    // The entry for `title`, rasterising it on first use. The reference stays
+    // valid until the next forget().
+    const Entry& get(const std::string& title) {
+        auto it = entries.find(title);
+        if (it != entries.end()) return it->second;
+        return entries.emplace(title, rasterise(title)).first->second;
+    }
+
+    void forget(const std::string& title) {
+        auto it = entries.find(title);
+        if (it == entries.end()) return;
+        wasted_area += size_t(it->second.rect.size.x) * it->second.rect.size.y;
+        entries.erase(it);
+
+        if (wasted_area > size_t(PAGE_SIZE) * PAGE_SIZE / 2) {
+            entries.clear();
+            pages.clear();
+            wasted_area = 0;
+        }
+    }
+
+    // Frame batching: clear(), add() every visible label, then draw()
+    void clear() {
+        for (auto& batch : batches) batch.clear();
+    }
+
+    void add(const Entry& entry, sf::Vector2f top_left, sf::Color color) {
+        batches.resize(pages.size(), sf::VertexArray(sf::PrimitiveType::Triangles));
+        sf::VertexArray& batch = batches[entry.page];
+
+        sf::Vector2f size(entry.rect.size);
+        sf::Vector2f tex(entry.rect.position);
+        sf::Vertex corners[4] = {
+            {top_left, color, tex},
+            {top_left + sf::Vector2f(size.x, 0), color, tex + sf::Vector2f(size.x, 0)},
+            {top_left + size, color, tex + size},
+            {top_left + sf::Vector2f(0, size.y), color, tex + sf::Vector2f(0, size.y)},
+        };
+        for (int k : {0, 1, 2, 0, 2, 3}) batch.append(corners[k]);
+    }
+
+    // Returns the number of draw calls issued
+    size_t draw(sf::RenderTarget& target) const {
+        size_t calls = 0;
+        for (size_t p = 0; p < batches.size() && p < pages.size(); p++) {
+            if (batches[p].getVertexCount() == 0) continue;
+            target.draw(batches[p], sf::RenderStates(&pages[p]->getTexture()));
+            calls++;
+        }
+        return calls;
+    }
+
+    size_t page_count() const { return pages.size(); }
+
+   private:
+    const sf::Font& font;
+    unsigned character_size;
+
+    std::unordered_map<std::string, Entry> entries;
+    std::vector<std::unique_ptr<sf::RenderTexture>> pages;
+    std::vector<sf::VertexArray> batches;  // by page
+
+    //Shelf packing state for the last page
+    unsigned cursor_x = 0, shelf_y = 0, shelf_height = 0;
+    size_t wasted_area = 0;
+
+    Entry rasterise(const std::string& title) {
+        sf::Text text(font, title, character_size);
+        text.setFillColor(sf::Color::White);
+        sf::FloatRect bounds = text.getLocalBounds();
+        unsigned width = std::min(PAGE_SIZE, unsigned(std::ceil(bounds.position.x + bounds.size.x)) + 1);
+        unsigned height = std::min(PAGE_SIZE, unsigned(std::ceil(bounds.position.y + bounds.size.y)) + 1);
+
+        if (pages.empty() || cursor_x + width > PAGE_SIZE) {
+            //Next shelf
+            shelf_y += shelf_height + PADDING;
+            cursor_x = 0;
+            shelf_height = 0;
+        }
+        if (pages.empty() || shelf_y + height > PAGE_SIZE) {
+            pages.push_back(std::make_unique<sf::RenderTexture>(sf::Vector2u(PAGE_SIZE, PAGE_SIZE)));
+            pages.back()->clear(sf::Color::Transparent);
+            cursor_x = shelf_y = shelf_height = 0;
+        }
+
+        sf::RenderTexture& page = *pages.back();
+        text.setPosition(sf::Vector2f(float(cursor_x), float(shelf_y)));
+        page.draw(text);
+        page.display();
+
+        Entry entry{pages.size() - 1, sf::IntRect(sf::Vector2i(cursor_x, shelf_y), sf::Vector2i(width, height))};
+        cursor_x += width + PADDING;
+        shelf_height = std::max(shelf_height, height);
+        return entry;
+    }
+};
@@ -10,11 +10,16 @@
 #include <sfml-3d/math4.hpp>
 
 #include "3d_mm.hpp"
+#include "frame_pacer.hpp"
 
 int main() {
     const int HEIGHT = 1400;
     const int WIDTH = 2100;
+    // While something moves; 0 for no limit. With nothing changing the loop
+    // sleeps instead of drawing, see FramePacer.
+    const unsigned FRAME_RATE_LIMIT = 120;
     sf::RenderWindow window(sf::VideoMode({WIDTH, HEIGHT}), "Mental Modeller");
+    window.setFramerateLimit(FRAME_RATE_LIMIT);
 
     std::cout << "window created" << std::endl;
 
@@ -24,11 +29,25 @@ int main() {
 
     Physical_MM* mm_3d = new Physical_MM(myMM, camera);
 
+    // F3 shows phase timings, F4 writes them to PROFILE_CSV_PATH
+    FrameProfiler profiler;
+    const std::string PROFILE_CSV_PATH = "frame_profile.csv";
+    mm_3d->profiler = &profiler;
 
 
+
+    FramePacer pacer;
+
     bool locked = false;
     while (window.isOpen()) {
-        while (const auto& event = window.pollEvent()) {
+        std::optional<sf::Event> event = pacer.first_event(window);
+        profiler.begin_frame();
+
+        //Anything that can change what is on screen: input of any kind
+        //(including edits and mouse moves), the camera, physics, GUI animations
+        bool changed = false;
+        for (; event; event = window.pollEvent()) {
+            changed = true;
             if (event->is<sf::Event::Closed>()) {
                 window.close();
             } else if (const auto* keyPressed = event->getIf<sf::Event::KeyPressed>()) {
@@ -43,8 +62,10 @@ int main() {
                         std::string path;
                         std::cin >> path;
                         
-                        mm_3d->save(path);
-                        std::cout << "System saved to: " << path << std::endl;
+                        SaveReport report = mm_3d->save(path);
+                        std::cout << "System saved to: " << path << " ("
+                                  << (report.incremental ? "incremental, " : "") << report.files
+                                  << " files, " << report.bytes << " bytes)" << std::endl;
 
                     } else if (choice == "L" || choice == "l") {
                         std::cout << "Enter directory name to load: ";
@@ -55,11 +76,21 @@ int main() {
                         // This replaces the current object with the loaded state
                         delete mm_3d;
                         mm_3d = new Physical_MM(path, camera);
+                        mm_3d->profiler = &profiler;
                         
                         std::cout << "System loaded from: " << path << std::endl;
                     } else {
                         std::cout << "Operation cancelled (invalid input)." << std::endl;
                     }
+                } else if (!locked && keyPressed->scancode == sf::Keyboard::Scan::F3) {
+                    profiler.visible = !profiler.visible;
+                } else if (!locked && keyPressed->scancode == sf::Keyboard::Scan::F4) {
+                    try {
+                        profiler.write_csv(PROFILE_CSV_PATH);
+                        std::cout << "Wrote " << profiler.size() << " frames to " << PROFILE_CSV_PATH << std::endl;
+                    } catch (const std::exception& e) {
+                        std::cout << e.what() << std::endl;
+                    }
                 }
             }
             
@@ -69,17 +100,30 @@ int main() {
 
             locked = mm_3d->handleEvent(window, event);
         }
+        profiler.lap(FrameProfiler::EVENTS);
+
         if (!locked) {
             camera.update();
         }
+        changed |= pacer.camera_moved(camera);
+        profiler.lap(FrameProfiler::CAMERA);
         
-        mm_3d->physics_step();
+        changed |= mm_3d->physics_step();
+        changed |= mm_3d->physicsRunning();
+        profiler.lap(FrameProfiler::PHYSICS);
+
+        changed |= mm_3d->gui.updateTime();
+        pacer.idle = !changed;
+        if (pacer.idle) continue;
 
         // - - DRAWING - -
         window.clear();
         mm_3d->render(window, camera);
         camera.drawCrosshairIfNeeded(window);
+        profiler.draw(window, FONT);
         window.display();
+        profiler.lap(FrameProfiler::PRESENT);
+        profiler.end_frame(mm_3d->frameCounts());
     }
 
     delete mm_3d;
@@ -11,6 +11,17 @@
 #include <cassert>
 #include <fstream>
 #include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "title_table.hpp"
+#include "worker_pool.hpp"
 
 namespace fs = std::filesystem;
 
@@ -85,71 +96,244 @@ bool lowercaseComparison(std::string a, std::string b) {
 
 const std::string LINK_CODE = "@#$%";
 
+
+// Node files are read and written by this many threads at once. At least a
+// few even on small machines, as the threads mostly wait on the file system.
+inline size_t default_io_threads() {
+    return std::max(4u, std::thread::hardware_concurrency());
+}
+
+// Whole file into `out`, sized up front from the file size. Text mode like
+// the rest of MM's I/O, so on Windows it may come out shorter than that.
+inline bool read_text_file(const fs::path& path, std::string& out) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    out.resize(ec ? 0 : size);
+    file.read(out.data(), out.size());
+    out.resize(file.gcount());
+    //The file may have grown since we asked for its size
+    if (file) out.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Bodies read on first access instead of at load (MM::lazy,
+// lazy_packed_mm). `read` returns a body by its index in the source; the last
+// bodies read are kept, at most `capacity` bytes of them, least recently used
+// out first, so memory stays flat however large the model is.
+struct BodyCache {
+    std::function<std::string(uint32_t)> read;
+    size_t capacity;
+
+    BodyCache(std::function<std::string(uint32_t)> read_, size_t capacity_)
+        : read(std::move(read_)), capacity(capacity_) {}
+
+    std::string get(uint32_t source) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(source);
+            if (it != index.end()) {
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->second;
+            }
+        }
+
+        //Read without the lock, so that threads saving the model read in parallel
+        std::string body = read(source);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!index.contains(source) && body.size() <= capacity) {
+            entries.emplace_front(source, body);
+            index[source] = entries.begin();
+            bytes += body.size();
+            while (bytes > capacity) {
+                bytes -= entries.back().second.size();
+                index.erase(entries.back().first);
+                entries.pop_back();
+            }
+        }
+        return body;
+    }
+
+    size_t cached_bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes;
+    }
+
+   private:
+    std::mutex mutex;
+    std::list<std::pair<uint32_t, std::string>> entries;  // most recently used first
+    std::unordered_map<uint32_t, std::list<std::pair<uint32_t, std::string>>::iterator> index;
+    size_t bytes = 0;
+};
+
+const size_t DEFAULT_BODY_CACHE_BYTES = 16 << 20;
+
+// Two nodes by their MM::titles ids
+struct Connection {
+    uint32_t first, second;
+
+    bool operator==(const Connection&) const = default;
+};
+
 struct MM {
     std::map<std::string, std::string> nodes;
-    std::vector<std::pair<std::string, std::string>> connections;
+    std::vector<Connection> connections;
+
+    // Ids of the titles connections refer to. Titles are only written out as
+    // text when saving; add connections with connect() and rename and remove
+    // nodes with rename_node() and erase_node() so ids follow along.
+    TitleTable titles;
+
+    // Index in connections by edge_key, for O(1) lookups and duplicate
+    // checks. Kept by connect() and disconnect_at(), the only ways
+    // connections should change. A duplicate connection (only a bad
+    // CONNECTIONS.txt can bring one in) has no entry of its own.
+    std::unordered_map<uint64_t, uint32_t> edge_index;
+
+    // Nodes whose body has not been read yet, by index in body_cache's
+    // source; nodes holds an empty string for them. Empty unless loaded with
+    // lazy bodies. Read bodies through body() and change them through
+    // set_body(), rename_node() and erase_node() so this stays right.
+    std::unordered_map<std::string, uint32_t> unread_bodies;
+    std::shared_ptr<BodyCache> body_cache;
 
     MM() {}
 
-    MM(const std::string& dir) {
-        fs::path dirPath(dir);
+    // Node files are listed in one pass, then read by `thread_count` threads
+    // in parallel and merged in title order, so the result does not depend on
+    // the thread count or the directory listing order
+    MM(const std::string& dir, size_t thread_count = default_io_threads()) {
+        auto files = list_node_files(dir);
+
+        // Read them, each thread a contiguous run of titles
+        std::vector<std::string> bodies(files.size());
+        WorkerPool pool(std::max<size_t>(1, std::min(thread_count, files.size())));
+        std::vector<uint8_t> failed(pool.size(), 0);
+        pool.run([&](size_t t) {
+            auto [begin, end] = WorkerPool::chunk(files.size(), pool.size(), t);
+            for (size_t i = begin; i < end; i++) {
+                if (!read_text_file(files[i].second, bodies[i])) failed[t] = 1;
+            }
+        });
+        assert(std::find(failed.begin(), failed.end(), 1) == failed.end() && "Failed to open node file.");
 
-        // Validate the directory
-        assert(fs::exists(dirPath) && "Directory does not exist.");
-        assert(fs::is_directory(dirPath) && "Path is not a directory.");
+        titles.reserve(files.size());
+        for (size_t i = 0; i < files.size(); i++) {
+            titles.intern(files[i].first);
+            nodes.emplace_hint(nodes.end(), std::move(files[i].first), std::move(bodies[i]));
+        }
+        load_connections(dir);
+    }
 
-        // Ensure CONNECTIONS.txt exists
-        fs::path connPath = dirPath / "CONNECTIONS.txt";
-        assert(fs::exists(connPath) && "CONNECTIONS.txt not found in directory.");
-        assert(fs::is_regular_file(connPath) && "CONNECTIONS.txt is not a regular file.");
+    // Only lists the node files; each body is read from its file when first
+    // asked for, through a cache of at most cache_bytes
+    static MM lazy(const std::string& dir, size_t cache_bytes = DEFAULT_BODY_CACHE_BYTES) {
+        auto files = list_node_files(dir);
+
+        auto paths = std::make_shared<std::vector<fs::path>>();
+        paths->reserve(files.size());
+        MM mm;
+        mm.unread_bodies.reserve(files.size());
+        mm.titles.reserve(files.size());
+        for (auto& [title, path] : files) {
+            mm.titles.intern(title);
+            mm.unread_bodies.emplace(title, paths->size());
+            paths->push_back(std::move(path));
+            mm.nodes.emplace_hint(mm.nodes.end(), std::move(title), std::string());
+        }
+        mm.body_cache = std::make_shared<BodyCache>([paths](uint32_t i) {
+            std::string body;
+            if (!read_text_file((*paths)[i], body)) {
+                throw std::runtime_error("Failed to open node file " + (*paths)[i].string());
+            }
+            return body;
+        }, cache_bytes);
 
-        // Load all node .txt files (everything except CONNECTIONS.txt)
-        for (const auto& entry : fs::directory_iterator(dirPath)) {
-            assert(fs::is_regular_file(entry.path()) && "Non-file entry found in directory.");
+        mm.load_connections(dir);
+        return mm;
+    }
 
-            std::string filename = entry.path().filename().string();
-            assert(filename.size() > 4 && filename.substr(filename.size() - 4) == ".txt"
-                && "Non-.txt file found in directory.");
+    std::string body(const std::string& title) const {
+        auto it = unread_bodies.find(title);
+        if (it != unread_bodies.end()) return body_cache->get(it->second);
+        return nodes.at(title);
+    }
 
-            if (filename == "CONNECTIONS.txt") continue;
+    // Reads every body not read yet into nodes and lets go of body_cache,
+    // and with it of the files it reads from
+    void read_all_bodies() {
+        for (const auto& [title, source] : unread_bodies) nodes[title] = body_cache->read(source);
+        unread_bodies.clear();
+        body_cache.reset();
+    }
 
-            std::string title = filename.substr(0, filename.size() - 4);
-            assert(isValidFilename(title) && "Invalid filename used as node title.");
-            assert(nodes.find(title) == nodes.end() && "Duplicate node title detected.");
+    void set_body(const std::string& title, std::string body) {
+        nodes[title] = std::move(body);
+        unread_bodies.erase(title);
+    }
 
-            std::ifstream file(entry.path());
-            assert(file.is_open() && "Failed to open node file.");
+    const std::string& title(uint32_t id) const { return titles[id]; }
 
-            std::string body((std::istreambuf_iterator<char>(file)),
-                            std::istreambuf_iterator<char>());
-            nodes[title] = body;
-        }
+    // The two ids in either order give the same key
+    static uint64_t edge_key(uint32_t a, uint32_t b) {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
 
-        // Load connections
-        std::ifstream connFile(connPath);
-        assert(connFile.is_open() && "Failed to open CONNECTIONS.txt.");
+    void connect(const std::string& first, const std::string& second) {
+        connect(titles.intern(first), titles.intern(second));
+    }
 
-        std::string line;
-        while (std::getline(connFile, line)) {
-            if (line.empty()) continue;
+    void connect(uint32_t first, uint32_t second) {
+        edge_index.try_emplace(edge_key(first, second), connections.size());
+        connections.push_back({first, second});
+    }
 
-            auto tabPos = line.find('\t');
-            assert(tabPos != std::string::npos && "Malformed connection line, no tab delimiter found.");
-            assert(tabPos > 0 && "Malformed connection line, first title is empty.");
-            assert(tabPos < line.size() - 1 && "Malformed connection line, second title is empty.");
+    // Index in connections of the connection between the two, in either
+    // direction, or -1
+    int64_t find_connection(const std::string& first, const std::string& second) const {
+        uint32_t a = titles.find(first), b = titles.find(second);
+        if (a == TitleTable::NONE || b == TitleTable::NONE) return -1;
+        auto it = edge_index.find(edge_key(a, b));
+        return it == edge_index.end() ? -1 : int64_t(it->second);
+    }
 
-            std::string a = line.substr(0, tabPos);
-            std::string b = line.substr(tabPos + 1);
+    // The last connection takes over the index
+    void disconnect_at(size_t index) {
+        assert(index < connections.size());
+        auto it = edge_index.find(edge_key(connections[index].first, connections[index].second));
+        if (it != edge_index.end() && it->second == index) edge_index.erase(it);
+
+        const size_t last = connections.size() - 1;
+        if (index != last) {
+            connections[index] = connections[last];
+            auto moved = edge_index.find(edge_key(connections[index].first, connections[index].second));
+            if (moved != edge_index.end() && moved->second == last) moved->second = index;
+        }
+        connections.pop_back();
 
-            // Ensure no extra tabs snuck in
-            assert(b.find('\t') == std::string::npos && "Malformed connection line, more than one tab delimiter.");
+        //Only with duplicates: one of them may have lost the entry it shared
+        if (edge_index.size() != connections.size()) index_connections();
+    }
 
-            // Both titles must exist as nodes
-            assert(nodes.find(a) != nodes.end() && "Connection references non-existent node.");
-            assert(nodes.find(b) != nodes.end() && "Connection references non-existent node.");
+    // Connections keep the node's id, so none of them change. The body moves
+    // with the title, so it is read here if it was not yet: the old title's
+    // file is going away.
+    void rename_node(const std::string& oldTitle, const std::string& newTitle) {
+        std::string moved = body(oldTitle);
+        nodes.erase(oldTitle);
+        unread_bodies.erase(oldTitle);
+        nodes[newTitle] = std::move(moved);
+        if (uint32_t id = titles.find(oldTitle); id != TitleTable::NONE) titles.rename(id, newTitle);
+    }
 
-            connections.push_back({a, b});
-        }
+    // After the node's connections are gone
+    void erase_node(const std::string& title) {
+        nodes.erase(title);
+        unread_bodies.erase(title);
+        if (uint32_t id = titles.find(title); id != TitleTable::NONE) titles.release(id);
     }
 
     bool are_all_titles_valid() {
@@ -162,28 +346,21 @@ struct MM {
     }
     bool any_self_connections() {
         for (auto& connection: connections) {
-            if (lowercaseComparison(connection.first, connection.second)) return true;
+            if (lowercaseComparison(title(connection.first), title(connection.second))) return true;
         }
         return false;
     }
-    bool any_duplicate_connections() {
-        for (auto it = connections.begin(); it != connections.end(); it++) {
-            for (auto jt = it; jt != connections.end(); jt++) {
-                if (it == jt) continue;
-                if ((it->first == jt->first && it->second == jt->second) || (it->first == jt->second && it->second == jt->first)) {
-                    return true;
-                }
-            }
-        }
-
-        return false;
-    }      
+    // Every distinct connection has an entry in edge_index
+    bool any_duplicate_connections() const {
+        return edge_index.size() != connections.size();
+    }
 
     
 
     bool are_all_connection_references_valid() const {
         for (const auto& [a, b] : connections) {
-            if (!nodes.contains(a) || !nodes.contains(b))
+            if (a >= titles.id_limit() || b >= titles.id_limit() ||
+                !nodes.contains(title(a)) || !nodes.contains(title(b)))
                 return false;
         }
         return true;
@@ -193,15 +370,16 @@ struct MM {
         std::cout << "= = = MM = = =\n";
         std::cout << "Nodes:\n";
         for (const auto& node : nodes) {
-            std::cout << node.first << ": " << node.second << std::endl;
+            std::cout << node.first << ": " << body(node.first) << std::endl;
         }
         std::cout << "\nConnections:\n";
         for (const auto& [a, b] : connections) {
-           std::cout << "a: " << a << " b: " << b << std::endl;
+           std::cout << "a: " << title(a) << " b: " << title(b) << std::endl;
         }
     }
 
-    void save(std::string dir) {
+    // Node files are written by `thread_count` threads in parallel
+    void save(std::string dir, size_t thread_count = default_io_threads()) {
         // 1. Validate state before doing anything
         if (!are_all_titles_valid()) {
             throw std::runtime_error("Cannot save: one or more node titles are not valid filenames.");
@@ -217,12 +395,33 @@ struct MM {
             fs::create_directories(tempDir);
 
             // Write each node as its own .txt file
-            for (const auto& [title, body] : nodes) {
-                std::ofstream file(tempDir / (title + ".txt"));
-                if (!file.is_open()) {
-                    throw std::runtime_error("Failed to open file for node: " + title);
+            std::vector<const std::pair<const std::string, std::string>*> entries;
+            entries.reserve(nodes.size());
+            for (const auto& node : nodes) entries.push_back(&node);
+
+            WorkerPool pool(std::max<size_t>(1, std::min(thread_count, entries.size())));
+            std::vector<std::string> errors(pool.size());
+            pool.run([&](size_t t) {
+                auto [begin, end] = WorkerPool::chunk(entries.size(), pool.size(), t);
+                for (size_t i = begin; i < end; i++) {
+                    const std::string& title = entries[i]->first;
+                    std::ofstream file(tempDir / (title + ".txt"));
+                    if (!file.is_open()) {
+                        errors[t] = "Failed to open file for node: " + title;
+                        return;
+                    }
+                    //A body not read yet may fail to read now; that fails the save
+                    try {
+                        if (unread_bodies.contains(title)) file << body(title);
+                        else file << entries[i]->second;
+                    } catch (const std::exception& e) {
+                        errors[t] = e.what();
+                        return;
+                    }
                 }
-                file << body;
+            });
+            for (const std::string& error : errors) {
+                if (!error.empty()) throw std::runtime_error(error);
             }
 
             // Write the CONNECTIONS file.
@@ -232,7 +431,7 @@ struct MM {
                 throw std::runtime_error("Failed to open CONNECTIONS.txt");
             }
             for (const auto& [a, b] : connections) {
-                connFile << a << "\t" << b << "\n";
+                connFile << title(a) << "\t" << title(b) << "\n";
             }
 
         } catch (...) {
@@ -256,8 +455,91 @@ struct MM {
         }
     }
 
+    // Connections are compared by title, as ids depend on the order titles
+    // were interned in
     bool operator==(const MM& b) const {
-        return nodes == b.nodes && connections == b.connections;
+        if (connections.size() != b.connections.size()) return false;
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (title(connections[i].first) != b.title(b.connections[i].first) ||
+                title(connections[i].second) != b.title(b.connections[i].second)) return false;
+        }
+
+        if (unread_bodies.empty() && b.unread_bodies.empty()) return nodes == b.nodes;
+        if (nodes.size() != b.nodes.size()) return false;
+        for (auto it = nodes.begin(), jt = b.nodes.begin(); it != nodes.end(); ++it, ++jt) {
+            if (it->first != jt->first || body(it->first) != b.body(jt->first)) return false;
+        }
+        return true;
+    }
+
+   private:
+    void index_connections() {
+        edge_index.clear();
+        for (size_t i = 0; i < connections.size(); i++) {
+            edge_index.try_emplace(edge_key(connections[i].first, connections[i].second), i);
+        }
+    }
+
+    // (title, path) of every node file in `dir`, sorted by title
+    static std::vector<std::pair<std::string, fs::path>> list_node_files(const std::string& dir) {
+        fs::path dirPath(dir);
+
+        // Validate the directory
+        assert(fs::exists(dirPath) && "Directory does not exist.");
+        assert(fs::is_directory(dirPath) && "Path is not a directory.");
+
+        // Ensure CONNECTIONS.txt exists
+        fs::path connPath = dirPath / "CONNECTIONS.txt";
+        assert(fs::exists(connPath) && "CONNECTIONS.txt not found in directory.");
+        assert(fs::is_regular_file(connPath) && "CONNECTIONS.txt is not a regular file.");
+
+        // Find all node .txt files (everything except CONNECTIONS.txt)
+        std::vector<std::pair<std::string, fs::path>> files;  // title, path
+        for (const auto& entry : fs::directory_iterator(dirPath)) {
+            assert(fs::is_regular_file(entry.path()) && "Non-file entry found in directory.");
+
+            std::string filename = entry.path().filename().string();
+            assert(filename.size() > 4 && filename.substr(filename.size() - 4) == ".txt"
+                && "Non-.txt file found in directory.");
+
+            if (filename == "CONNECTIONS.txt") continue;
+
+            std::string title = filename.substr(0, filename.size() - 4);
+            assert(isValidFilename(title) && "Invalid filename used as node title.");
+            files.emplace_back(std::move(title), entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        assert(std::adjacent_find(files.begin(), files.end(), [](const auto& a, const auto& b) {
+                   return a.first == b.first;
+               }) == files.end() && "Duplicate node title detected.");
+        return files;
+    }
+
+    void load_connections(const std::string& dir) {
+        std::ifstream connFile(fs::path(dir) / "CONNECTIONS.txt");
+        assert(connFile.is_open() && "Failed to open CONNECTIONS.txt.");
+
+        std::string line;
+        while (std::getline(connFile, line)) {
+            if (line.empty()) continue;
+
+            auto tabPos = line.find('\t');
+            assert(tabPos != std::string::npos && "Malformed connection line, no tab delimiter found.");
+            assert(tabPos > 0 && "Malformed connection line, first title is empty.");
+            assert(tabPos < line.size() - 1 && "Malformed connection line, second title is empty.");
+
+            std::string a = line.substr(0, tabPos);
+            std::string b = line.substr(tabPos + 1);
+
+            // Ensure no extra tabs snuck in
+            assert(b.find('\t') == std::string::npos && "Malformed connection line, more than one tab delimiter.");
+
+            // Both titles must exist as nodes
+            assert(nodes.find(a) != nodes.end() && "Connection references non-existent node.");
+            assert(nodes.find(b) != nodes.end() && "Connection references non-existent node.");
+
+            connect(a, b);
+        }
     }
 
 };
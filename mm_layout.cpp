@@ -0,0 +1,188 @@
+// mm-layout: headless batch layout for saved models.
+//
+// Loads a model directory as written by Physical_MM::save (Mental-Model/ plus
+// physics.bin), runs the same simulation the editor uses without opening a
+// window, and writes physics.bin back. A .mmpack file works the same way; its
+// layout is rewritten in place of physics.bin.
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#include "mm.hpp"
+#include "physics.hpp"
+#include "physics_bin.hpp"
+#include "journal.hpp"
+#include "multilevel_layout.hpp"
+#include "packed_mm.hpp"
+
+
+static void usage() {
+    std::cerr <<
+        "usage: mm-layout <model-dir | file.mmpack> [options]\n"
+        "  --steps N          stop after N steps (default 10000)\n"
+        "  --energy E         converge once kinetic energy < E (default 0.01)\n"
+        "  --threads T        physics threads (default: all cores)\n"
+        "  --barnes-hut THETA use Barnes-Hut repulsion with opening angle THETA\n"
+        "  --integrator NAME  euler | semi-implicit | verlet (default semi-implicit)\n"
+        "  --dt SCALE         step length in original frame-steps (default 1)\n"
+        "  --substeps S       substeps per step (default 1)\n"
+        "  --fresh            ignore the stored layout and start from a new one\n"
+        "  --dry-run          do not write the layout back\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+
+    std::string path = argv[1];
+    size_t max_steps = 10000;
+    bool dry_run = false;
+    bool fresh = false;
+
+    Simulation sim;
+    sim.thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--steps" && has_value) {
+            max_steps = std::stoull(argv[++i]);
+        } else if (arg == "--energy" && has_value) {
+            sim.idle_energy = std::stof(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            sim.thread_count = std::max(1ull, std::stoull(argv[++i]));
+        } else if (arg == "--barnes-hut" && has_value) {
+            sim.repulsion_mode = Simulation::BARNES_HUT;
+            sim.barnes_hut_theta = std::stof(argv[++i]);
+        } else if (arg == "--integrator" && has_value) {
+            std::string name = argv[++i];
+            if (name == "euler") sim.integrator = Simulation::EXPLICIT_EULER;
+            else if (name == "semi-implicit") sim.integrator = Simulation::SEMI_IMPLICIT_EULER;
+            else if (name == "verlet") sim.integrator = Simulation::VELOCITY_VERLET;
+            else {
+                usage();
+                return 2;
+            }
+        } else if (arg == "--dt" && has_value) {
+            sim.fixed_dt = std::stof(argv[++i]) / Simulation::REFERENCE_RATE;
+        } else if (arg == "--substeps" && has_value) {
+            sim.substeps = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--fresh") {
+            fresh = true;
+        } else if (arg == "--dry-run") {
+            dry_run = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    const bool packed = is_packed_path(path);
+    if (packed ? !fs::is_regular_file(path)
+               : !fs::is_directory(path) || !fs::is_directory(path + "/Mental-Model")) {
+        std::cerr << "Not a model directory or .mmpack file: " << path << std::endl;
+        return 1;
+    }
+
+    auto load_start = std::chrono::steady_clock::now();
+
+    // Same ids as Physical_MM: node i is the i-th title of mm.nodes
+    std::vector<std::string> titles;
+    std::vector<uint8_t> placed_mask;
+    size_t placed = 0;
+    MM mm;
+
+    if (packed) {
+        //Nodes and edges are already indices in the pack; only the titles
+        //are copied out, for writing the layout back
+        PackedModel pack(path);
+        titles.reserve(pack.node_count());
+        placed_mask.assign(pack.node_count(), 0);
+        for (size_t i = 0; i < pack.node_count(); i++) {
+            sim.add_node(0, 0, 0);
+            titles.emplace_back(pack.title(i));
+            if (const float* p = pack.position(i); p && !fresh) {
+                sim.set_position(i, p[0], p[1], p[2]);
+                placed_mask[i] = 1;
+                placed++;
+            }
+        }
+        for (size_t e = 0; e < pack.edge_count(); e++) {
+            auto [a, b] = pack.edge(e);
+            sim.add_edge(a, b);
+        }
+        if (!dry_run) mm = pack.to_mm();
+    } else {
+        //As last edited, with any unsaved edits from the journal
+        ModelDirectory model = load_model_directory(path);
+        mm = std::move(model.mm);
+
+        std::unordered_map<std::string, uint32_t> ids;
+        titles.reserve(mm.nodes.size());
+
+        for (const auto& node : mm.nodes) {
+            ids[node.first] = sim.add_node(0, 0, 0);
+            titles.push_back(node.first);
+        }
+        for (const auto& [a, b] : mm.connections) {
+            sim.add_edge(ids[mm.title(a)], ids[mm.title(b)]);
+        }
+
+        if (fresh) model.layout.clear();
+        placed = apply_layout(model.layout, titles, sim, placed_mask);
+    }
+
+    // Nodes without a stored position (all of them for a fresh model) get a
+    // multilevel initial layout
+    if (placed < sim.size()) MultilevelLayout().place_missing(sim, placed_mask);
+
+    double load_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - load_start).count();
+
+    std::cout << "model: " << path << "\n"
+              << "nodes: " << sim.size() << ", connections: " << sim.edge_count()
+              << ", positioned from the stored layout: " << placed << "\n"
+              << "loaded in " << load_seconds << " s" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t steps = 0;
+    while (steps < max_steps && !sim.idle) {
+        sim.step();
+        steps++;
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "steps: " << steps << (sim.idle ? " (converged)" : " (step limit)") << "\n"
+              << "time: " << seconds << " s, "
+              << (seconds > 0 ? steps / seconds : 0.0) << " steps/s\n"
+              << "final energy: " << sim.energy() << ", awake nodes: " << sim.awake_count()
+              << std::endl;
+
+    if (!dry_run && packed) {
+        // write_packed swaps the new file in itself
+        LayoutPositions positions = current_layout(titles, sim);
+        write_packed(path, mm, &positions);
+        std::cout << "wrote " << path << std::endl;
+    } else if (!dry_run) {
+        // Write next to the old file and swap, so an interrupted run never
+        // leaves a truncated physics.bin behind
+        std::string temp = path + "/physics.bin.tmp";
+        write_physics_bin(temp, titles, sim);
+        fs::rename(temp, path + "/physics.bin");
+        std::cout << "wrote " << path << "/physics.bin" << std::endl;
+    }
+
+    return 0;
+}
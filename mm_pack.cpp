@@ -0,0 +1,111 @@
+// mm-pack: converts between model directories and .mmpack files.
+//
+//   mm-pack <model-dir> <file.mmpack>   packs Mental-Model/ and physics.bin
+//   mm-pack <file.mmpack> <model-dir>   unpacks into a model directory
+//
+// Either way the result is read back and compared with the source, so a
+// conversion that would lose anything fails instead of being left behind.
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+#include "mm.hpp"
+#include "journal.hpp"
+#include "packed_mm.hpp"
+#include "physics_bin.hpp"
+
+
+static void usage() {
+    std::cerr <<
+        "usage: mm-pack <model-dir> <file.mmpack>\n"
+        "       mm-pack <file.mmpack> <model-dir>\n";
+}
+
+// Positions of the nodes of `mm` only, as loading would apply them
+static LayoutPositions model_layout(const MM& mm, const LayoutPositions& positions) {
+    LayoutPositions result;
+    for (const auto& node : mm.nodes) {
+        auto it = positions.find(node.first);
+        if (it != positions.end()) result.insert(*it);
+    }
+    return result;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        usage();
+        return 2;
+    }
+    std::string from = argv[1], to = argv[2];
+
+    try {
+        if (!is_packed_path(from) && is_packed_path(to)) {
+            if (!fs::is_directory(from + "/Mental-Model")) {
+                std::cerr << "Not a model directory: " << from << std::endl;
+                return 1;
+            }
+            auto start = std::chrono::steady_clock::now();
+            //As last edited, with any unsaved edits from the journal
+            ModelDirectory model = load_model_directory(from);
+            const MM& mm = model.mm;
+            bool has_layout = !model.layout.empty();
+            LayoutPositions positions = model_layout(mm, model.layout);
+            std::cout << "read " << from << " in " << seconds_since(start) << " s" << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            write_packed(to, mm, has_layout ? &positions : nullptr);
+            std::cout << "wrote " << to << " in " << seconds_since(start) << " s" << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            PackedModel pack(to);
+            bool same = pack.to_mm() == mm && pack.layout_positions() == positions;
+            std::cout << "read back in " << seconds_since(start) << " s" << std::endl;
+            if (!same) {
+                std::cerr << "Packed model differs from " << from << std::endl;
+                return 1;
+            }
+
+        } else if (is_packed_path(from) && !is_packed_path(to)) {
+            auto start = std::chrono::steady_clock::now();
+            PackedModel pack(from);
+            MM mm = pack.to_mm();
+            LayoutPositions positions = pack.layout_positions();
+            std::cout << "read " << from << " in " << seconds_since(start) << " s" << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            fs::create_directories(to);
+            mm.save(to + "/Mental-Model");
+            if (pack.has_layout()) {
+                std::string temp = to + "/physics.bin.tmp";
+                write_physics_bin(temp, positions);
+                fs::rename(temp, to + "/physics.bin");
+            }
+            std::cout << "wrote " << to << " in " << seconds_since(start) << " s" << std::endl;
+
+            LayoutPositions written;
+            read_physics_bin(to + "/physics.bin", written);
+            if (!(MM(to + "/Mental-Model") == mm) || written != positions) {
+                std::cerr << "Unpacked model differs from " << from << std::endl;
+                return 1;
+            }
+
+        } else {
+            usage();
+            return 2;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
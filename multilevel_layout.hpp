@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "adjacency.hpp"
+#include "physics.hpp"
+
+
+/*
+Multilevel initial layout (graph coarsening in the style of FM^3 / Walshaw).
+
+The graph is repeatedly collapsed by matching every node with an unmatched
+neighbour of lowest degree; nodes left over join a matched neighbour's group,
+and isolated nodes are paired with each other, so every level roughly halves.
+Once at most coarsest_size nodes remain they are placed at random and relaxed,
+then each level is prolonged (children start next to their parent, slightly
+jittered so they never coincide) and relaxed again with the same forces the
+editor uses. The finest level therefore starts near its equilibrium instead
+of in a uniform random cube.
+*/
+struct MultilevelLayout {
+    size_t coarsest_size = 8;
+    size_t steps_per_level = 60;
+    uint32_t seed = 1;
+
+    // Lays out every node of sim, using its edges and force settings
+    void layout(Simulation& sim) const {
+        std::vector<float> x, y, z;
+        layout_graph(sim, sim.size(), sim.edge_a, sim.edge_b, x, y, z);
+        for (size_t i = 0; i < sim.size(); i++) sim.set_position(i, x[i], y[i], z[i]);
+    }
+
+    // Keeps the nodes with placed[i] set and positions the others: nodes
+    // reachable from a placed node are put at the mean of their already
+    // positioned neighbours (breadth first), and components with no placed
+    // node at all get their own multilevel layout beside the existing one.
+    void place_missing(Simulation& sim, std::vector<uint8_t> placed) const {
+        const size_t n = sim.size();
+        size_t placed_count = std::count(placed.begin(), placed.end(), 1);
+        if (placed_count == n) return;
+        if (placed_count == 0) {
+            layout(sim);
+            return;
+        }
+
+        std::mt19937 gen(seed);
+        const float jitter = 0.25f * natural_length(sim);
+        std::uniform_real_distribution<float> offset(-jitter, jitter);
+
+        const Adjacency& adj = sim.adjacency();
+
+        std::deque<uint32_t> queue;
+        for (uint32_t i = 0; i < n; i++) {
+            if (placed[i]) queue.push_back(i);
+        }
+        while (!queue.empty()) {
+            uint32_t u = queue.front();
+            queue.pop_front();
+            for (uint32_t k = adj.begin(u); k < adj.end(u); k++) {
+                uint32_t v = adj.neighbours[k];
+                if (placed[v]) continue;
+
+                float sx = 0, sy = 0, sz = 0;
+                int count = 0;
+                for (uint32_t m = adj.begin(v); m < adj.end(v); m++) {
+                    uint32_t w = adj.neighbours[m];
+                    if (!placed[w]) continue;
+                    sx += sim.px[w]; sy += sim.py[w]; sz += sim.pz[w];
+                    count++;
+                }
+                sim.set_position(v, sx / count + offset(gen), sy / count + offset(gen),
+                                 sz / count + offset(gen));
+                placed[v] = 1;
+                queue.push_back(v);
+            }
+        }
+
+        //Whatever is left is not connected to the loaded layout at all
+        std::vector<uint32_t> local(n, UINT32_MAX);
+        std::vector<uint32_t> missing;
+        for (uint32_t i = 0; i < n; i++) {
+            if (placed[i]) continue;
+            local[i] = missing.size();
+            missing.push_back(i);
+        }
+        if (missing.empty()) return;
+
+        std::vector<uint32_t> sub_a, sub_b;
+        for (size_t e = 0; e < sim.edge_count(); e++) {
+            if (local[sim.edge_a[e]] == UINT32_MAX) continue;
+            sub_a.push_back(local[sim.edge_a[e]]);
+            sub_b.push_back(local[sim.edge_b[e]]);
+        }
+        std::vector<float> x, y, z;
+        layout_graph(sim, missing.size(), sub_a, sub_b, x, y, z);
+
+        float cx = 0, cy = 0, cz = 0, radius = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (local[i] != UINT32_MAX) continue;
+            cx += sim.px[i]; cy += sim.py[i]; cz += sim.pz[i];
+        }
+        const float anchored = n - missing.size();
+        cx /= anchored; cy /= anchored; cz /= anchored;
+        for (uint32_t i = 0; i < n; i++) {
+            if (local[i] != UINT32_MAX) continue;
+            radius = std::max(radius, std::hypot(sim.px[i] - cx, sim.py[i] - cy, sim.pz[i] - cz));
+        }
+
+        float mx = 0, my = 0, mz = 0, extent = 0;
+        for (size_t k = 0; k < missing.size(); k++) {
+            mx += x[k]; my += y[k]; mz += z[k];
+        }
+        mx /= missing.size(); my /= missing.size(); mz /= missing.size();
+        for (size_t k = 0; k < missing.size(); k++) {
+            extent = std::max(extent, std::hypot(x[k] - mx, y[k] - my, z[k] - mz));
+        }
+
+        float shift = radius + extent + natural_length(sim);
+        for (size_t k = 0; k < missing.size(); k++) {
+            sim.set_position(missing[k], x[k] - mx + cx + shift, y[k] - my + cy, z[k] - mz + cz);
+        }
+    }
+
+   private:
+    struct Level {
+        size_t n = 0;
+        std::vector<uint32_t> edge_a, edge_b;
+        std::vector<uint32_t> parent;  // node -> node of the next coarser level
+    };
+
+    // Distance at which one spring balances the repulsion of one other node
+    static float natural_length(const Simulation& sim) {
+        return std::cbrt(sim.columb_K / sim.hooke_K);
+    }
+
+    static void coarsen(Level& fine, Level& coarse, std::mt19937& gen) {
+        Adjacency adj;
+        adj.build(fine.n, fine.edge_a, fine.edge_b);
+        auto degree = [&](uint32_t v) { return adj.degree(v); };
+
+        std::vector<uint32_t> order(fine.n);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), gen);
+
+        const uint32_t NONE = UINT32_MAX;
+        fine.parent.assign(fine.n, NONE);
+        uint32_t next = 0;
+
+        for (uint32_t u : order) {
+            if (fine.parent[u] != NONE) continue;
+            uint32_t best = NONE;
+            for (uint32_t k = adj.begin(u); k < adj.end(u); k++) {
+                uint32_t v = adj.neighbours[k];
+                if (v == u || fine.parent[v] != NONE) continue;
+                if (best == NONE || degree(v) < degree(best)) best = v;
+            }
+            if (best != NONE) fine.parent[u] = fine.parent[best] = next++;
+        }
+
+        //Unmatched nodes only have matched neighbours: join one of them.
+        //Isolated nodes are paired among themselves.
+        uint32_t lonely = NONE;
+        for (uint32_t u : order) {
+            if (fine.parent[u] != NONE) continue;
+            if (degree(u) > 0) {
+                fine.parent[u] = fine.parent[adj.neighbours[adj.begin(u)]];
+            } else if (lonely == NONE) {
+                fine.parent[u] = next++;
+                lonely = u;
+            } else {
+                fine.parent[u] = fine.parent[lonely];
+                lonely = NONE;
+            }
+        }
+
+        coarse.n = next;
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+        edges.reserve(fine.edge_a.size());
+        for (size_t e = 0; e < fine.edge_a.size(); e++) {
+            uint32_t a = fine.parent[fine.edge_a[e]];
+            uint32_t b = fine.parent[fine.edge_b[e]];
+            if (a == b) continue;
+            edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        coarse.edge_a.clear();
+        coarse.edge_b.clear();
+        for (auto [a, b] : edges) {
+            coarse.edge_a.push_back(a);
+            coarse.edge_b.push_back(b);
+        }
+    }
+
+    void relax(const Simulation& settings, const Level& level, std::vector<float>& x,
+               std::vector<float>& y, std::vector<float>& z) const {
+        Simulation sim = settings;
+        if (level.n > 2000) sim.repulsion_mode = Simulation::BARNES_HUT;
+        for (size_t i = 0; i < level.n; i++) sim.add_node(x[i], y[i], z[i]);
+        for (size_t e = 0; e < level.edge_a.size(); e++) sim.add_edge(level.edge_a[e], level.edge_b[e]);
+
+        for (size_t s = 0; s < steps_per_level && !sim.idle; s++) sim.step();
+
+        x = sim.px;
+        y = sim.py;
+        z = sim.pz;
+    }
+
+    void layout_graph(const Simulation& params, size_t n, const std::vector<uint32_t>& edge_a,
+                      const std::vector<uint32_t>& edge_b, std::vector<float>& x,
+                      std::vector<float>& y, std::vector<float>& z) const {
+        Simulation settings = params;
+        settings.clear();
+
+        std::mt19937 gen(seed);
+        std::vector<Level> levels(1);
+        levels[0].n = n;
+        levels[0].edge_a = edge_a;
+        levels[0].edge_b = edge_b;
+
+        while (levels.back().n > coarsest_size) {
+            Level coarse;
+            coarsen(levels.back(), coarse, gen);
+            if (coarse.n * 20 > levels.back().n * 19) {
+                //Not shrinking any more (e.g. lots of parallel components)
+                levels.back().parent.clear();
+                break;
+            }
+            levels.push_back(std::move(coarse));
+        }
+
+        const float length = natural_length(settings);
+        const Level& top = levels.back();
+        std::uniform_real_distribution<float> spread(-length * std::cbrt(float(top.n)),
+                                                     length * std::cbrt(float(top.n)));
+        x.resize(top.n);
+        y.resize(top.n);
+        z.resize(top.n);
+        for (size_t i = 0; i < top.n; i++) {
+            x[i] = spread(gen);
+            y[i] = spread(gen);
+            z[i] = spread(gen);
+        }
+        relax(settings, top, x, y, z);
+
+        std::uniform_real_distribution<float> jitter(-0.25f * length, 0.25f * length);
+        for (size_t l = levels.size() - 1; l-- > 0;) {
+            const Level& fine = levels[l];
+            std::vector<float> fx(fine.n), fy(fine.n), fz(fine.n);
+            for (size_t i = 0; i < fine.n; i++) {
+                uint32_t p = fine.parent[i];
+                fx[i] = x[p] + jitter(gen);
+                fy[i] = y[p] + jitter(gen);
+                fz[i] = z[p] + jitter(gen);
+            }
+            x.swap(fx);
+            y.swap(fy);
+            z.swap(fz);
+            relax(settings, fine, x, y, z);
+        }
+    }
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mm.hpp"
+#include "physics_bin.hpp"
+
+
+/*
+Packed model: a whole saved model (the Mental-Model directory plus
+physics.bin) in one .mmpack file, so loading is one open and one mapping
+instead of one file per node.
+
+    PackHeader
+    PackedNode[node_count]          by title order (the order of MM::nodes)
+    uint32 a, b [edge_count]        node indices, in MM::connections order
+    float x, y, z [node_count]      if PACK_HAS_LAYOUT; NaN x for no position
+    title bytes                     the string table, no separators
+    body bytes
+
+All offsets are from the start of the file, numbers are little-endian as in
+physics.bin. PackedModel maps the file read-only and hands out views into
+it; nothing is copied until it is turned into an MM.
+
+Converting a directory to a pack and back gives the same node files and
+CONNECTIONS.txt; physics.bin keeps the position of every node (entries for
+titles that are not in the model are dropped, as loading ignores them).
+*/
+const std::string PACK_EXTENSION = ".mmpack";
+
+inline bool is_packed_path(const std::string& path) {
+    return fs::path(path).extension() == PACK_EXTENSION;
+}
+
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t node_count;
+    uint64_t edge_count;
+    uint64_t nodes_offset;
+    uint64_t edges_offset;
+    uint64_t layout_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+};
+
+struct PackedNode {
+    uint64_t title_offset;
+    uint64_t body_offset;
+    uint64_t body_size;
+    uint32_t title_size;
+    uint32_t reserved;
+};
+
+constexpr char PACK_MAGIC[8] = {'M', 'M', 'P', 'A', 'C', 'K', '\r', '\n'};
+constexpr uint32_t PACK_VERSION = 1;
+constexpr uint32_t PACK_HAS_LAYOUT = 1;
+
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Cannot open " + path);
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size)) {
+            CloseHandle(file);
+            throw std::runtime_error("Cannot read the size of " + path);
+        }
+        length = size_t(file_size.QuadPart);
+        if (length > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (!bytes) {
+                if (mapping) CloseHandle(mapping);
+                CloseHandle(file);
+                throw std::runtime_error("Cannot map " + path);
+            }
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot read the size of " + path);
+        }
+        length = size_t(st.st_size);
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            bytes = static_cast<const char*>(p);
+        }
+        //The mapping stays valid without the descriptor
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+   private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+
+// Zero-copy view of a .mmpack file. The constructor checks that every offset
+// stays inside the file and throws std::runtime_error if not; after that,
+// titles, bodies and edges are read straight from the mapping.
+struct PackedModel {
+    explicit PackedModel(const std::string& path) : file(path) {
+        const std::string error = path + " is not a valid packed model";
+        if (file.size() < sizeof(PackHeader)) throw std::runtime_error(error);
+        header = reinterpret_cast<const PackHeader*>(file.data());
+        if (std::memcmp(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 ||
+            header->version != PACK_VERSION || header->file_size != file.size()) {
+            throw std::runtime_error(error);
+        }
+
+        const uint64_t n = header->node_count, e = header->edge_count;
+        if (!section_fits(header->nodes_offset, n, sizeof(PackedNode)) ||
+            !section_fits(header->edges_offset, e, 2 * sizeof(uint32_t)) ||
+            (has_layout() && !section_fits(header->layout_offset, n, 3 * sizeof(float)))) {
+            throw std::runtime_error(error);
+        }
+        nodes = reinterpret_cast<const PackedNode*>(file.data() + header->nodes_offset);
+        edges = reinterpret_cast<const uint32_t*>(file.data() + header->edges_offset);
+        if (has_layout()) layout = reinterpret_cast<const float*>(file.data() + header->layout_offset);
+
+        for (uint64_t i = 0; i < n; i++) {
+            if (!section_fits(nodes[i].title_offset, nodes[i].title_size, 1) ||
+                !section_fits(nodes[i].body_offset, nodes[i].body_size, 1)) {
+                throw std::runtime_error(error);
+            }
+        }
+        for (uint64_t k = 0; k < 2 * e; k++) {
+            if (edges[k] >= n) throw std::runtime_error(error);
+        }
+    }
+
+    size_t node_count() const { return header->node_count; }
+    size_t edge_count() const { return header->edge_count; }
+    bool has_layout() const { return header->flags & PACK_HAS_LAYOUT; }
+
+    std::string_view title(size_t i) const {
+        return {file.data() + nodes[i].title_offset, nodes[i].title_size};
+    }
+    std::string_view body(size_t i) const {
+        return {file.data() + nodes[i].body_offset, size_t(nodes[i].body_size)};
+    }
+    std::pair<uint32_t, uint32_t> edge(size_t e) const { return {edges[2 * e], edges[2 * e + 1]}; }
+
+    // Null if the pack has no layout or this node has no position
+    const float* position(size_t i) const {
+        if (!layout || std::isnan(layout[3 * i])) return nullptr;
+        return layout + 3 * i;
+    }
+
+    MM to_mm() const {
+        MM mm;
+        mm.titles.reserve(node_count());
+        for (size_t i = 0; i < node_count(); i++) {
+            //Nodes are stored in map order, so each insert goes at the end
+            mm.titles.intern(std::string(title(i)));
+            mm.nodes.emplace_hint(mm.nodes.end(), std::string(title(i)), std::string(body(i)));
+        }
+        assert(mm.nodes.size() == node_count() && "Duplicate node title detected.");
+
+        //Interned in node order, so a node's index is its id
+        mm.connections.reserve(edge_count());
+        mm.edge_index.reserve(edge_count());
+        for (size_t e = 0; e < edge_count(); e++) {
+            auto [a, b] = edge(e);
+            mm.connect(a, b);
+        }
+        return mm;
+    }
+
+    LayoutPositions layout_positions() const {
+        LayoutPositions positions;
+        for (size_t i = 0; i < node_count(); i++) {
+            if (const float* p = position(i)) positions[std::string(title(i))] = {p[0], p[1], p[2]};
+        }
+        return positions;
+    }
+
+   private:
+    MappedFile file;
+    const PackHeader* header = nullptr;
+    const PackedNode* nodes = nullptr;
+    const uint32_t* edges = nullptr;
+    const float* layout = nullptr;
+
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t item_size) const {
+        return offset <= file.size() && count <= (file.size() - offset) / item_size;
+    }
+};
+
+
+// Like PackedModel::to_mm, but bodies are copied out of the mapping only when
+// first asked for (see BodyCache); the mapping stays open as long as the MM
+// or a copy of it needs it
+inline MM lazy_packed_mm(std::shared_ptr<const PackedModel> pack, size_t cache_bytes = DEFAULT_BODY_CACHE_BYTES) {
+    MM mm;
+    mm.unread_bodies.reserve(pack->node_count());
+    mm.titles.reserve(pack->node_count());
+    for (size_t i = 0; i < pack->node_count(); i++) {
+        std::string title(pack->title(i));
+        mm.titles.intern(title);
+        mm.unread_bodies.emplace(title, i);
+        mm.nodes.emplace_hint(mm.nodes.end(), std::move(title), std::string());
+    }
+    assert(mm.nodes.size() == pack->node_count() && "Duplicate node title detected.");
+
+    //Interned in node order, so a node's index is its id
+    mm.connections.reserve(pack->edge_count());
+    mm.edge_index.reserve(pack->edge_count());
+    for (size_t e = 0; e < pack->edge_count(); e++) {
+        auto [a, b] = pack->edge(e);
+        mm.connect(a, b);
+    }
+    mm.body_cache = std::make_shared<BodyCache>(
+        [pack](uint32_t i) { return std::string(pack->body(i)); }, cache_bytes);
+    return mm;
+}
+
+
+// Writes `mm` (and the positions in `layout`, if given) as a packed model.
+// The file is written next to `path` and renamed over it once complete.
+inline void write_packed(const std::string& path, const MM& mm, const LayoutPositions* layout) {
+    const uint64_t n = mm.nodes.size(), e = mm.connections.size();
+
+    PackHeader header{};
+    std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.version = PACK_VERSION;
+    header.flags = layout ? PACK_HAS_LAYOUT : 0;
+    header.node_count = n;
+    header.edge_count = e;
+    header.nodes_offset = sizeof(PackHeader);
+    header.edges_offset = header.nodes_offset + n * sizeof(PackedNode);
+    header.layout_offset = header.edges_offset + e * 2 * sizeof(uint32_t);
+    header.strings_offset = header.layout_offset + (layout ? n * 3 * sizeof(float) : 0);
+
+    //Titles first, then bodies, both in node order
+    std::vector<PackedNode> nodes(n);
+    std::vector<uint32_t> index(mm.titles.id_limit(), UINT32_MAX);  // node index by title id
+    uint64_t offset = header.strings_offset;
+    uint32_t i = 0;
+    for (const auto& [title, body] : mm.nodes) {
+        nodes[i].title_offset = offset;
+        nodes[i].title_size = title.size();
+        offset += title.size();
+        if (uint32_t id = mm.titles.find(title); id != TitleTable::NONE) index[id] = i;
+        i++;
+    }
+
+    std::vector<uint32_t> edges;
+    edges.reserve(2 * e);
+    for (const auto& [a, b] : mm.connections) {
+        if (a >= index.size() || b >= index.size() || index[a] == UINT32_MAX || index[b] == UINT32_MAX) {
+            throw std::runtime_error("Cannot pack: connection references a non-existent node.");
+        }
+        edges.push_back(index[a]);
+        edges.push_back(index[b]);
+    }
+
+    std::string temp_path = path + ".tmp";
+    std::ofstream out;
+    try {
+        out.open(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("Failed to open " + temp_path + " for writing.");
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(PackedNode));
+        out.write(reinterpret_cast<const char*>(edges.data()), edges.size() * sizeof(uint32_t));
+        if (layout) {
+            std::vector<float> coords(3 * n, NAN);
+            i = 0;
+            for (const auto& node : mm.nodes) {
+                auto it = layout->find(node.first);
+                if (it != layout->end()) std::copy(it->second.begin(), it->second.end(), &coords[3 * i]);
+                i++;
+            }
+            out.write(reinterpret_cast<const char*>(coords.data()), coords.size() * sizeof(float));
+        }
+        for (const auto& node : mm.nodes) out.write(node.first.data(), node.first.size());
+
+        //Bodies last, as they come: a lazily loaded one is only read here, so
+        //its size is known after the fact and the table is written again
+        i = 0;
+        for (const auto& [title, resident] : mm.nodes) {
+            const bool unread = mm.unread_bodies.contains(title);
+            const std::string read = unread ? mm.body(title) : std::string();
+            const std::string& body = unread ? read : resident;
+            nodes[i].body_offset = offset;
+            nodes[i++].body_size = body.size();
+            offset += body.size();
+            out.write(body.data(), body.size());
+        }
+        header.file_size = offset;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(PackedNode));
+
+        out.close();
+        if (!out) throw std::runtime_error("Failed to write " + temp_path + ".");
+    } catch (...) {
+        //Also when reading a lazily loaded body fails: no partial pack is left
+        out.close();
+        std::error_code ec;
+        fs::remove(temp_path, ec);
+        throw;
+    }
+    fs::rename(temp_path, path);
+}
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "adjacency.hpp"
+#include "barnes_hut.hpp"
+#include "repulsion_kernels.hpp"
+#include "worker_pool.hpp"
+
+
+/*
+Simulation state for the force-directed layout, kept as structure-of-arrays.
+
+Nodes are addressed by a dense integer id (0 .. size()-1), which is the same id
+Physical_MM uses for id_to_title. Edges are stored as pairs of node ids in the
+same order as MM::connections. Removing a node or edge moves the last one into
+its place (swap-and-pop), which callers mirror in their own dense arrays.
+Every node keeps the list of its incident edges, so edits cost O(degree);
+the spring pass runs over a CSR adjacency (adjacency()) derived from the
+edge list. Nothing in here knows about titles, SFML or the
+renderer; Physical_MM copies positions out into its Sphere3D/Label3D/Line3D
+objects after each step.
+*/
+struct Simulation {
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+
+    std::vector<uint32_t> edge_a, edge_b;
+
+    // Sleeping: a node whose squared speed stays under sleep_energy for
+    // sleep_after_steps steps stops being integrated (it still repels the
+    // others). It wakes once a single step would change its velocity by more
+    // than wake_energy, or when an edit touches it or its neighbours.
+    std::vector<uint8_t> asleep;
+    std::vector<uint16_t> calm_steps;
+    float sleep_energy = 1e-4f;
+    float wake_energy = 1e-4f;
+    uint16_t sleep_after_steps = 30;
+
+    // Once the kinetic energy of all awake nodes drops under idle_energy the
+    // simulation goes idle and step() does nothing until an edit wakes it
+    float idle_energy = 1e-2f;
+    bool idle = false;
+
+    // Integration. The force constants were tuned for one step per frame at
+    // REFERENCE_RATE, so each step of fixed_dt seconds advances by
+    // fixed_dt * REFERENCE_RATE of those original steps, split into
+    // `substeps` equal parts. SEMI_IMPLICIT_EULER (velocity first, then
+    // position with the new velocity) is the original update;
+    // EXPLICIT_EULER moves with the old velocity (it blows up on this force
+    // model and is only there for comparison), VELOCITY_VERLET is second
+    // order and stays stable at larger fixed_dt.
+    enum Integrator {
+        EXPLICIT_EULER,
+        SEMI_IMPLICIT_EULER,
+        VELOCITY_VERLET
+    };
+    static constexpr float REFERENCE_RATE = 60.0f;
+    Integrator integrator = Integrator::SEMI_IMPLICIT_EULER;
+    float fixed_dt = 1.0f / REFERENCE_RATE;
+    int substeps = 1;
+
+    // advance(): simulated seconds per wall-clock second, and the most steps
+    // one call may take before it gives up on catching up
+    float time_scale = 1.0f;
+    size_t max_steps_per_advance = 8;
+
+    /*
+    Forces:
+    - Attractive connection force (hooke's law)
+    - Repelling node force (columb's law)
+    - Dampening friction force
+    - Bounding attractive force
+    */
+    float evth_const = 0.1f;
+    float hooke_K = 0.01f * evth_const;
+    float columb_K = 250 * evth_const;
+    float dampening_constant = std::pow(0.9, evth_const);
+    float bounding_constant = 0.000001f * evth_const;
+
+    // Coulomb repulsion: exact pairwise sum, or Barnes-Hut approximation
+    // opening cells whose size/distance exceeds barnes_hut_theta
+    enum RepulsionMode {
+        EXACT,
+        BARNES_HUT
+    };
+    RepulsionMode repulsion_mode = RepulsionMode::EXACT;
+    float barnes_hut_theta = 0.5f;
+
+    // Instruction set for the exact pairwise kernel; detected once, can be
+    // forced down (e.g. to SCALAR) for comparisons
+    repulsion::ISA kernel_isa = repulsion::detect_isa();
+
+    // Threads used for the repulsion pass. Work is split by fixed node ranges
+    // and per-thread results are summed in thread order, so a given thread
+    // count always produces the same layout; 1 runs everything inline.
+    size_t thread_count = 1;
+
+
+    size_t size() const { return px.size(); }
+    size_t edge_count() const { return edge_a.size(); }
+
+    // Kinetic energy (unit masses) and awake nodes after the last step
+    float energy() const { return kinetic_energy; }
+    size_t awake_count() const { return awake_nodes; }
+
+    uint32_t add_node(float x, float y, float z) {
+        px.push_back(x); py.push_back(y); pz.push_back(z);
+        vx.push_back(0); vy.push_back(0); vz.push_back(0);
+        asleep.push_back(0);
+        calm_steps.push_back(0);
+        incident.emplace_back();
+        idle = false;
+        forces_valid = false;
+        adjacency_valid = false;
+        return static_cast<uint32_t>(px.size() - 1);
+    }
+
+    // The last node takes over id `id`, mirroring a swap-and-pop of
+    // id_to_title. Edges touching the node must have been removed beforehand.
+    void remove_node(uint32_t id) {
+        assert(id < size());
+        assert(incident[id].empty());
+        const uint32_t last = size() - 1;
+
+        if (id != last) {
+            for (auto* array : {&px, &py, &pz, &vx, &vy, &vz}) (*array)[id] = (*array)[last];
+            asleep[id] = asleep[last];
+            calm_steps[id] = calm_steps[last];
+            for (uint32_t e : incident[last]) {
+                if (edge_a[e] == last) edge_a[e] = id;
+                if (edge_b[e] == last) edge_b[e] = id;
+            }
+            incident[id].swap(incident[last]);
+        }
+
+        for (auto* array : {&px, &py, &pz, &vx, &vy, &vz}) array->pop_back();
+        asleep.pop_back();
+        calm_steps.pop_back();
+        incident.pop_back();
+        idle = false;
+        forces_valid = false;
+        adjacency_valid = false;
+    }
+
+    // Edge edits wake both endpoints and their neighbours
+    void add_edge(uint32_t a, uint32_t b) {
+        assert(a < size() && b < size());
+        const uint32_t e = edge_count();
+        edge_a.push_back(a);
+        edge_b.push_back(b);
+        incident[a].push_back(e);
+        if (b != a) incident[b].push_back(e);
+        edges_changed(a, b);
+    }
+
+    // The last edge takes over index `index`, mirroring a swap-and-pop of
+    // MM::connections
+    void remove_edge(size_t index) {
+        assert(index < edge_count());
+        const uint32_t a = edge_a[index];
+        const uint32_t b = edge_b[index];
+        const uint32_t last = edge_count() - 1;
+
+        unlink(a, index);
+        if (b != a) unlink(b, index);
+        if (index != last) {
+            edge_a[index] = edge_a[last];
+            edge_b[index] = edge_b[last];
+            relink(edge_a[index], last, index);
+            if (edge_b[index] != edge_a[index]) relink(edge_b[index], last, index);
+        }
+        edge_a.pop_back();
+        edge_b.pop_back();
+        edges_changed(a, b);
+    }
+
+    // Indices of the edges touching node id, in no particular order
+    const std::vector<uint32_t>& incident_edges(uint32_t id) const { return incident[id]; }
+
+    uint32_t other_end(uint32_t edge, uint32_t id) const {
+        return edge_a[edge] == id ? edge_b[edge] : edge_a[edge];
+    }
+
+    // Neighbours and incident edge indices of every node in CSR form,
+    // rebuilt after edge edits the first time it is asked for
+    const Adjacency& adjacency() {
+        if (!adjacency_valid) {
+            adjacency_cache.build(size(), edge_a, edge_b);
+            adjacency_valid = true;
+        }
+        return adjacency_cache;
+    }
+
+    // Index of the edge between a and b, or -1
+    int64_t find_edge(uint32_t a, uint32_t b) const {
+        if (incident[b].size() < incident[a].size()) std::swap(a, b);
+        for (uint32_t e : incident[a]) {
+            if (other_end(e, a) == b) return e;
+        }
+        return -1;
+    }
+
+    void wake(uint32_t id) {
+        asleep[id] = 0;
+        calm_steps[id] = 0;
+        idle = false;
+    }
+
+    // The node and everything connected to it
+    void wake_around(uint32_t id) {
+        wake(id);
+        for (uint32_t e : incident[id]) wake(other_end(e, id));
+    }
+
+    void wake_all() {
+        for (uint32_t i = 0; i < size(); i++) wake(i);
+        forces_valid = false;
+    }
+
+    // Drops every node and edge, keeping the settings
+    void clear() {
+        for (auto* array : {&px, &py, &pz, &vx, &vy, &vz}) array->clear();
+        edge_a.clear();
+        edge_b.clear();
+        asleep.clear();
+        calm_steps.clear();
+        incident.clear();
+        idle = false;
+        forces_valid = false;
+        adjacency_valid = false;
+        accumulator = 0;
+    }
+
+    void set_position(uint32_t id, float x, float y, float z) {
+        px[id] = x; py[id] = y; pz[id] = z;
+        forces_valid = false;
+    }
+
+
+    // One fixed step of fixed_dt seconds, split into `substeps` substeps
+    void step() {
+        if (size() == 0 || idle) return;
+
+        const float h = fixed_dt * REFERENCE_RATE / substeps;
+        for (int s = 0; s < substeps; s++) substep(h);
+
+        idle = kinetic_energy < idle_energy;
+    }
+
+    // Runs as many fixed steps as `seconds` of wall-clock time cover, carrying
+    // the remainder over to the next call. Returns the number of steps taken.
+    size_t advance(float seconds) {
+        if (idle) {
+            accumulator = 0;
+            return 0;
+        }
+
+        accumulator += seconds * time_scale;
+        size_t steps = 0;
+        while (accumulator >= fixed_dt && !idle) {
+            if (steps == max_steps_per_advance) {
+                //Falling behind real time: drop the backlog instead of spiralling
+                accumulator = 0;
+                break;
+            }
+            step();
+            accumulator -= fixed_dt;
+            steps++;
+        }
+        return steps;
+    }
+
+   private:
+    float kinetic_energy = 0;
+    size_t awake_nodes = 0;
+    float accumulator = 0;
+
+    // Accelerations at the current positions. Velocity Verlet reuses them
+    // from the previous substep, so any edit invalidates them.
+    std::vector<float> fx, fy, fz;
+    std::vector<float> prev_fx, prev_fy, prev_fz;
+    bool forces_valid = false;
+
+    std::vector<std::vector<uint32_t>> incident;  // by node: indices of its edges
+
+    Adjacency adjacency_cache;
+    bool adjacency_valid = false;
+
+    void unlink(uint32_t id, uint32_t edge) {
+        auto& list = incident[id];
+        auto it = std::find(list.begin(), list.end(), edge);
+        assert(it != list.end());
+        *it = list.back();
+        list.pop_back();
+    }
+
+    void relink(uint32_t id, uint32_t from, uint32_t to) {
+        auto& list = incident[id];
+        *std::find(list.begin(), list.end(), from) = to;
+    }
+
+    void edges_changed(uint32_t a, uint32_t b) {
+        forces_valid = false;
+        adjacency_valid = false;
+        wake_around(a);
+        wake_around(b);
+    }
+
+    void compute_forces() {
+        const size_t n = size();
+        fx.resize(n);
+        fy.resize(n);
+        fz.resize(n);
+
+        //Hooke's law along every connection, gathered per node so every
+        //thread only writes the nodes of its own range
+        const Adjacency& adj = adjacency();
+        const size_t threads = std::max<size_t>(1, std::min(thread_count, n));
+        workers.get(threads).run([&](size_t t) {
+            auto [begin, end] = WorkerPool::chunk(n, threads, t);
+            for (size_t i = begin; i < end; i++) {
+                float sx = 0, sy = 0, sz = 0;
+                for (uint32_t k = adj.begin(i); k < adj.end(i); k++) {
+                    uint32_t j = adj.neighbours[k];
+                    sx += px[j] - px[i];
+                    sy += py[j] - py[i];
+                    sz += pz[j] - pz[i];
+                }
+                fx[i] = sx * hooke_K;
+                fy[i] = sy * hooke_K;
+                fz[i] = sz * hooke_K;
+            }
+        });
+
+        //Columb's law
+        if (repulsion_mode == RepulsionMode::BARNES_HUT) {
+            repulsion_barnes_hut();
+        } else {
+            repulsion_exact();
+        }
+
+        //Bounding force: summed over every pair it is n * bounding_constant
+        //times the offset to the centroid, so it only needs the centroid
+        float cx = 0, cy = 0, cz = 0;
+        for (size_t i = 0; i < n; i++) {
+            cx += px[i]; cy += py[i]; cz += pz[i];
+        }
+        cx /= n; cy /= n; cz /= n;
+        const float bounding_factor = bounding_constant * n;
+        for (size_t i = 0; i < n; i++) {
+            fx[i] += bounding_factor * (cx - px[i]);
+            fy[i] += bounding_factor * (cy - py[i]);
+            fz[i] += bounding_factor * (cz - pz[i]);
+        }
+
+        forces_valid = true;
+    }
+
+    // Stores the new velocity of node i, applying the sleep rules, and counts
+    // its energy if it stays awake
+    void settle(size_t i, float nvx, float nvy, float nvz) {
+        float v_sq = nvx * nvx + nvy * nvy + nvz * nvz;
+
+        //A sleeping node started this substep at rest, so v is just its kick
+        if (asleep[i] && v_sq <= wake_energy) {
+            vx[i] = vy[i] = vz[i] = 0;
+            return;
+        }
+        if (asleep[i]) wake(i);
+
+        if (v_sq < sleep_energy) {
+            if (++calm_steps[i] >= sleep_after_steps) {
+                asleep[i] = 1;
+                vx[i] = vy[i] = vz[i] = 0;
+                return;
+            }
+        } else {
+            calm_steps[i] = 0;
+        }
+
+        vx[i] = nvx; vy[i] = nvy; vz[i] = nvz;
+        kinetic_energy += 0.5f * v_sq;
+        awake_nodes++;
+    }
+
+    // Advances by h reference steps (h = 1 is one step of the original
+    // per-frame integration). Dampening is applied as dampening_constant^h so
+    // it does not depend on how a step is subdivided.
+    void substep(float h) {
+        const size_t n = size();
+        const float damping = std::pow(dampening_constant, h);
+        kinetic_energy = 0;
+        awake_nodes = 0;
+
+        if (integrator == Integrator::VELOCITY_VERLET) {
+            if (!forces_valid) compute_forces();
+
+            for (size_t i = 0; i < n; i++) {
+                if (asleep[i]) continue;
+                px[i] += (vx[i] + 0.5f * fx[i] * h) * h;
+                py[i] += (vy[i] + 0.5f * fy[i] * h) * h;
+                pz[i] += (vz[i] + 0.5f * fz[i] * h) * h;
+            }
+
+            prev_fx.swap(fx);
+            prev_fy.swap(fy);
+            prev_fz.swap(fz);
+            compute_forces();
+
+            for (size_t i = 0; i < n; i++) {
+                settle(i, (vx[i] + 0.5f * (prev_fx[i] + fx[i]) * h) * damping,
+                          (vy[i] + 0.5f * (prev_fy[i] + fy[i]) * h) * damping,
+                          (vz[i] + 0.5f * (prev_fz[i] + fz[i]) * h) * damping);
+            }
+            return;
+        }
+
+        compute_forces();
+
+        if (integrator == Integrator::EXPLICIT_EULER) {
+            for (size_t i = 0; i < n; i++) {
+                px[i] += vx[i] * h; py[i] += vy[i] * h; pz[i] += vz[i] * h;
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            settle(i, (vx[i] + fx[i] * h) * damping,
+                      (vy[i] + fy[i] * h) * damping,
+                      (vz[i] + fz[i] * h) * damping);
+        }
+
+        if (integrator == Integrator::SEMI_IMPLICIT_EULER) {
+            for (size_t i = 0; i < n; i++) {
+                px[i] += vx[i] * h; py[i] += vy[i] * h; pz[i] += vz[i] * h;
+            }
+        }
+        forces_valid = false;
+    }
+    BarnesHutTree repulsion_tree;
+
+    // Per-thread force accumulators for the halved exact kernel, where any
+    // thread may write to any j > i
+    std::vector<std::vector<float>> partial_fx, partial_fy, partial_fz;
+    std::vector<size_t> row_split;
+
+    // Copies of a Simulation start without threads and spin up their own
+    struct LazyPool {
+        std::unique_ptr<WorkerPool> pool;
+
+        LazyPool() = default;
+        LazyPool(const LazyPool&) {}
+        LazyPool& operator=(const LazyPool&) { return *this; }
+
+        WorkerPool& get(size_t thread_count) {
+            if (!pool || pool->size() != thread_count) {
+                pool.reset();
+                pool = std::make_unique<WorkerPool>(thread_count);
+            }
+            return *pool;
+        }
+    } workers;
+
+    // Splits the rows of the upper triangle so every thread gets about the
+    // same number of pairs (row i has n - 1 - i of them)
+    void split_rows(size_t n, size_t parts) {
+        row_split.assign(parts + 1, n);
+        row_split[0] = 0;
+
+        double total = 0.5 * double(n) * double(n - 1);
+        double done = 0;
+        size_t t = 1;
+        for (size_t i = 0; i < n && t < parts; i++) {
+            done += double(n - 1 - i);
+            while (t < parts && done >= total * t / parts) row_split[t++] = i + 1;
+        }
+    }
+
+    void repulsion_exact() {
+        const size_t n = size();
+        const size_t threads = std::max<size_t>(1, std::min(thread_count, n));
+        if (threads == 1) {
+            repulsion::run(kernel_isa, px.data(), py.data(), pz.data(), n, columb_K,
+                           fx.data(), fy.data(), fz.data(), 0, n);
+            return;
+        }
+
+        split_rows(n, threads);
+        partial_fx.resize(threads);
+        partial_fy.resize(threads);
+        partial_fz.resize(threads);
+
+        WorkerPool& pool = workers.get(threads);
+        pool.run([&](size_t t) {
+            partial_fx[t].assign(n, 0);
+            partial_fy[t].assign(n, 0);
+            partial_fz[t].assign(n, 0);
+            repulsion::run(kernel_isa, px.data(), py.data(), pz.data(), n, columb_K,
+                           partial_fx[t].data(), partial_fy[t].data(), partial_fz[t].data(),
+                           row_split[t], row_split[t + 1]);
+        });
+
+        //Fixed-order reduction: node i always sums thread 0, 1, 2, ...
+        pool.run([&](size_t t) {
+            auto [begin, end] = WorkerPool::chunk(n, threads, t);
+            for (size_t i = begin; i < end; i++) {
+                for (size_t p = 0; p < threads; p++) {
+                    fx[i] += partial_fx[p][i];
+                    fy[i] += partial_fy[p][i];
+                    fz[i] += partial_fz[p][i];
+                }
+            }
+        });
+    }
+
+    void repulsion_barnes_hut() {
+        const size_t n = size();
+        repulsion_tree.build(px.data(), py.data(), pz.data(), n);
+
+        //Each node only writes its own force, so no reduction is needed
+        const size_t threads = std::max<size_t>(1, std::min(thread_count, n));
+        workers.get(threads).run([&](size_t t) {
+            auto [begin, end] = WorkerPool::chunk(n, threads, t);
+            for (size_t i = begin; i < end; i++) {
+                repulsion_tree.accumulate_repulsion(i, columb_K, barnes_hut_theta,
+                                                    fx[i], fy[i], fz[i]);
+            }
+        });
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "physics.hpp"
+
+
+/*
+physics.bin, written next to Mental-Model by Physical_MM::save:
+
+    uint64 count
+    count times:
+        uint64 title length, title bytes
+        float x, y, z
+*/
+using LayoutPositions = std::unordered_map<std::string, std::array<float, 3>>;
+
+// Returns false if there is no physics.bin at `path`
+inline bool read_physics_bin(const std::string& path, LayoutPositions& positions) {
+    std::ifstream bin(path, std::ios::binary);
+    if (!bin.is_open()) return false;
+
+    uint64_t count = 0;
+    bin.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+    for (uint64_t i = 0; i < count && bin; ++i) {
+        uint64_t len;
+        bin.read(reinterpret_cast<char*>(&len), sizeof(len));
+
+        std::string title(len, '\0');
+        bin.read(title.data(), len);
+
+        std::array<float, 3> coords;
+        bin.read(reinterpret_cast<char*>(coords.data()), sizeof(coords));
+
+        if (bin) positions[title] = coords;
+    }
+    return true;
+}
+
+// titles[i] is the title of simulation node i
+inline void write_physics_bin(const std::string& path, const std::vector<std::string>& titles,
+                              const Simulation& sim) {
+    std::ofstream bin(path, std::ios::binary);
+    if (!bin.is_open()) {
+        throw std::runtime_error("Failed to open physics.bin for writing.");
+    }
+
+    uint64_t count = static_cast<uint64_t>(titles.size());
+    bin.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    for (size_t i = 0; i < titles.size(); i++) {
+        // Write Title length and data
+        uint64_t len = static_cast<uint64_t>(titles[i].size());
+        bin.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        bin.write(titles[i].data(), len);
+
+        // Write position (x, y, z) as floats
+        float coords[3] = {sim.px[i], sim.py[i], sim.pz[i]};
+        bin.write(reinterpret_cast<const char*>(coords), sizeof(coords));
+    }
+
+    if (!bin) {
+        throw std::runtime_error("Failed to write physics.bin.");
+    }
+}
+
+// Same file from positions by title, e.g. when unpacking a .mmpack
+inline void write_physics_bin(const std::string& path, const LayoutPositions& positions) {
+    std::ofstream bin(path, std::ios::binary);
+    if (!bin.is_open()) {
+        throw std::runtime_error("Failed to open physics.bin for writing.");
+    }
+
+    uint64_t count = static_cast<uint64_t>(positions.size());
+    bin.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    for (const auto& [title, coords] : positions) {
+        uint64_t len = static_cast<uint64_t>(title.size());
+        bin.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        bin.write(title.data(), len);
+        bin.write(reinterpret_cast<const char*>(coords.data()), sizeof(coords));
+    }
+
+    if (!bin) {
+        throw std::runtime_error("Failed to write physics.bin.");
+    }
+}
+
+// Positions of the simulation by title; titles[i] is the title of node i
+inline LayoutPositions current_layout(const std::vector<std::string>& titles, const Simulation& sim) {
+    LayoutPositions positions;
+    positions.reserve(titles.size());
+    for (size_t i = 0; i < titles.size(); i++) {
+        positions[titles[i]] = {sim.px[i], sim.py[i], sim.pz[i]};
+    }
+    return positions;
+}
+
+// Moves every node whose title has a stored position there and flags it in
+// `placed` (sized to sim). Returns how many nodes were placed.
+inline size_t apply_layout(const LayoutPositions& positions,
+                           const std::vector<std::string>& titles, Simulation& sim,
+                           std::vector<uint8_t>& placed) {
+    placed.assign(titles.size(), 0);
+    size_t count = 0;
+    for (size_t i = 0; i < titles.size(); i++) {
+        auto it = positions.find(titles[i]);
+        if (it == positions.end()) continue;
+        sim.set_position(i, it->second[0], it->second[1], it->second[2]);
+        placed[i] = 1;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MM_REPULSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MM_TARGET(isa)
+#endif
+
+
+/*
+Exact pairwise Coulomb kernels for Simulation::repulsion_exact.
+
+Each kernel walks rows [row_begin, row_end) and, for every row i, the columns
+j > i, so each unordered pair is visited once: the force K * d / r^3 is added
+to node i and subtracted from node j (Newton's third law). Output arrays are
+accumulated into, not overwritten, and must hold all n nodes since any j > i
+can be written.
+
+The SIMD versions replace pow(r^2, 1.5) by rsqrt with one Newton-Raphson
+refinement, which is accurate to roughly 1e-7 relative. Which one runs is
+picked at runtime from the CPU; scalar() is always available.
+*/
+namespace repulsion {
+
+enum class ISA {
+    SCALAR,
+    SSE,
+    AVX2
+};
+
+inline const char* isa_name(ISA isa) {
+    switch (isa) {
+        case ISA::AVX2: return "AVX2";
+        case ISA::SSE: return "SSE";
+        default: return "scalar";
+    }
+}
+
+inline ISA detect_isa() {
+#if defined(MM_REPULSION_X86) && (defined(__GNUC__) || defined(__clang__))
+    if (__builtin_cpu_supports("avx2")) return ISA::AVX2;
+    if (__builtin_cpu_supports("sse2")) return ISA::SSE;
+    return ISA::SCALAR;
+#elif defined(MM_REPULSION_X86) && (defined(_M_X64) || defined(__SSE2__))
+    return ISA::SSE;
+#else
+    return ISA::SCALAR;
+#endif
+}
+
+
+inline void scalar(const float* x, const float* y, const float* z, size_t n, float K,
+                   float* fx, float* fy, float* fz, size_t row_begin, size_t row_end) {
+    for (size_t i = row_begin; i < row_end; i++) {
+        float ax = 0, ay = 0, az = 0;
+        for (size_t j = i + 1; j < n; j++) {
+            float dx = x[i] - x[j];
+            float dy = y[i] - y[j];
+            float dz = z[i] - z[j];
+            float r_sq = dx * dx + dy * dy + dz * dz;
+            float s = K / (r_sq * std::sqrt(r_sq));
+
+            ax += s * dx; ay += s * dy; az += s * dz;
+            fx[j] -= s * dx; fy[j] -= s * dy; fz[j] -= s * dz;
+        }
+        fx[i] += ax; fy[i] += ay; fz[i] += az;
+    }
+}
+
+
+#ifdef MM_REPULSION_X86
+
+MM_TARGET("sse2")
+inline float hsum(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+MM_TARGET("sse2")
+inline void sse(const float* x, const float* y, const float* z, size_t n, float K,
+                float* fx, float* fy, float* fz, size_t row_begin, size_t row_end) {
+    const __m128 k = _mm_set1_ps(K);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three_halves = _mm_set1_ps(1.5f);
+
+    for (size_t i = row_begin; i < row_end; i++) {
+        const __m128 xi = _mm_set1_ps(x[i]);
+        const __m128 yi = _mm_set1_ps(y[i]);
+        const __m128 zi = _mm_set1_ps(z[i]);
+        __m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+
+        size_t j = i + 1;
+        for (; j + 4 <= n; j += 4) {
+            __m128 dx = _mm_sub_ps(xi, _mm_loadu_ps(x + j));
+            __m128 dy = _mm_sub_ps(yi, _mm_loadu_ps(y + j));
+            __m128 dz = _mm_sub_ps(zi, _mm_loadu_ps(z + j));
+            __m128 r_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                     _mm_mul_ps(dz, dz));
+
+            __m128 inv_r = _mm_rsqrt_ps(r_sq);
+            inv_r = _mm_mul_ps(inv_r, _mm_sub_ps(three_halves,
+                        _mm_mul_ps(_mm_mul_ps(half, r_sq), _mm_mul_ps(inv_r, inv_r))));
+            __m128 s = _mm_mul_ps(k, _mm_mul_ps(inv_r, _mm_mul_ps(inv_r, inv_r)));
+
+            __m128 sx = _mm_mul_ps(s, dx), sy = _mm_mul_ps(s, dy), sz = _mm_mul_ps(s, dz);
+            ax = _mm_add_ps(ax, sx); ay = _mm_add_ps(ay, sy); az = _mm_add_ps(az, sz);
+            _mm_storeu_ps(fx + j, _mm_sub_ps(_mm_loadu_ps(fx + j), sx));
+            _mm_storeu_ps(fy + j, _mm_sub_ps(_mm_loadu_ps(fy + j), sy));
+            _mm_storeu_ps(fz + j, _mm_sub_ps(_mm_loadu_ps(fz + j), sz));
+        }
+
+        float rx = hsum(ax), ry = hsum(ay), rz = hsum(az);
+        for (; j < n; j++) {
+            float dx = x[i] - x[j];
+            float dy = y[i] - y[j];
+            float dz = z[i] - z[j];
+            float r_sq = dx * dx + dy * dy + dz * dz;
+            float s = K / (r_sq * std::sqrt(r_sq));
+
+            rx += s * dx; ry += s * dy; rz += s * dz;
+            fx[j] -= s * dx; fy[j] -= s * dy; fz[j] -= s * dz;
+        }
+        fx[i] += rx; fy[i] += ry; fz[i] += rz;
+    }
+}
+
+MM_TARGET("avx2")
+inline float hsum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    __m128 sum = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(sum);
+    __m128 sums = _mm_add_ps(sum, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+MM_TARGET("avx2")
+inline void avx2(const float* x, const float* y, const float* z, size_t n, float K,
+                 float* fx, float* fy, float* fz, size_t row_begin, size_t row_end) {
+    const __m256 k = _mm256_set1_ps(K);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+
+    for (size_t i = row_begin; i < row_end; i++) {
+        const __m256 xi = _mm256_set1_ps(x[i]);
+        const __m256 yi = _mm256_set1_ps(y[i]);
+        const __m256 zi = _mm256_set1_ps(z[i]);
+        __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+
+        size_t j = i + 1;
+        for (; j + 8 <= n; j += 8) {
+            __m256 dx = _mm256_sub_ps(xi, _mm256_loadu_ps(x + j));
+            __m256 dy = _mm256_sub_ps(yi, _mm256_loadu_ps(y + j));
+            __m256 dz = _mm256_sub_ps(zi, _mm256_loadu_ps(z + j));
+            __m256 r_sq = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                _mm256_mul_ps(dz, dz));
+
+            __m256 inv_r = _mm256_rsqrt_ps(r_sq);
+            inv_r = _mm256_mul_ps(inv_r, _mm256_sub_ps(three_halves,
+                        _mm256_mul_ps(_mm256_mul_ps(half, r_sq), _mm256_mul_ps(inv_r, inv_r))));
+            __m256 s = _mm256_mul_ps(k, _mm256_mul_ps(inv_r, _mm256_mul_ps(inv_r, inv_r)));
+
+            __m256 sx = _mm256_mul_ps(s, dx), sy = _mm256_mul_ps(s, dy), sz = _mm256_mul_ps(s, dz);
+            ax = _mm256_add_ps(ax, sx); ay = _mm256_add_ps(ay, sy); az = _mm256_add_ps(az, sz);
+            _mm256_storeu_ps(fx + j, _mm256_sub_ps(_mm256_loadu_ps(fx + j), sx));
+            _mm256_storeu_ps(fy + j, _mm256_sub_ps(_mm256_loadu_ps(fy + j), sy));
+            _mm256_storeu_ps(fz + j, _mm256_sub_ps(_mm256_loadu_ps(fz + j), sz));
+        }
+
+        float rx = hsum(ax), ry = hsum(ay), rz = hsum(az);
+        for (; j < n; j++) {
+            float dx = x[i] - x[j];
+            float dy = y[i] - y[j];
+            float dz = z[i] - z[j];
+            float r_sq = dx * dx + dy * dy + dz * dz;
+            float s = K / (r_sq * std::sqrt(r_sq));
+
+            rx += s * dx; ry += s * dy; rz += s * dz;
+            fx[j] -= s * dx; fy[j] -= s * dy; fz[j] -= s * dz;
+        }
+        fx[i] += rx; fy[i] += ry; fz[i] += rz;
+    }
+}
+
+#endif  // MM_REPULSION_X86
+
+
+inline void run(ISA isa, const float* x, const float* y, const float* z, size_t n, float K,
+                float* fx, float* fy, float* fz, size_t row_begin, size_t row_end) {
+#ifdef MM_REPULSION_X86
+    if (isa == ISA::AVX2) return avx2(x, y, z, n, K, fx, fy, fz, row_begin, row_end);
+    if (isa == ISA::SSE) return sse(x, y, z, n, K, fx, fy, fz, row_begin, row_end);
+#endif
+    scalar(x, y, z, n, K, fx, fy, fz, row_begin, row_end);
+}
+
+}  // namespace repulsion
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+
+/*
+Uniform grid over the window, rebuilt every frame from projected shapes.
+
+Items are dense indices (0 .. item_count-1, e.g. positions in
+Object3D_Collection::c) registered with their screen-space bounding box, or
+as a thickened segment that only occupies the cells it passes through. A
+point query then visits just the items of the cell under the point, and a
+rectangle query the items whose boxes overlap the rectangle, each once.
+Items outside the window are clamped to the border cells, so queries only
+make sense inside it.
+*/
+struct ScreenGrid {
+    float cell_size = 64.0f;
+
+    void reset(sf::Vector2u window_size, size_t item_count) {
+        columns = std::max(1, int(std::ceil(window_size.x / cell_size)));
+        rows = std::max(1, int(std::ceil(window_size.y / cell_size)));
+        cells.resize(size_t(columns) * rows);
+        for (auto& cell : cells) cell.clear();
+
+        bounds.assign(item_count, sf::FloatRect());
+        stamp.assign(item_count, 0);
+        query_stamp = 0;
+    }
+
+    void insert_box(uint32_t item, sf::FloatRect box) {
+        bounds[item] = box;
+        int x0 = column(box.position.x), x1 = column(box.position.x + box.size.x);
+        int y0 = row(box.position.y), y1 = row(box.position.y + box.size.y);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) add(item, x, y);
+        }
+    }
+
+    // Segment a-b, widened by `pad` on every side
+    void insert_segment(uint32_t item, sf::Vector2f a, sf::Vector2f b, float pad) {
+        sf::Vector2f lo(std::min(a.x, b.x) - pad, std::min(a.y, b.y) - pad);
+        sf::Vector2f hi(std::max(a.x, b.x) + pad, std::max(a.y, b.y) + pad);
+        bounds[item] = sf::FloatRect(lo, hi - lo);
+
+        //Walk the segment in half-cell steps and mark the padded cells
+        //around each sample; consecutive samples mostly hit the same cells
+        float dx = b.x - a.x, dy = b.y - a.y;
+        float length = std::sqrt(dx * dx + dy * dy);
+        int samples = std::max(1, int(std::ceil(length / (cell_size * 0.5f))));
+        for (int s = 0; s <= samples; s++) {
+            float t = float(s) / samples;
+            float x = a.x + dx * t, y = a.y + dy * t;
+            for (int cy = row(y - pad - cell_size * 0.5f); cy <= row(y + pad + cell_size * 0.5f); cy++) {
+                for (int cx = column(x - pad - cell_size * 0.5f); cx <= column(x + pad + cell_size * 0.5f); cx++) {
+                    add(item, cx, cy);
+                }
+            }
+        }
+    }
+
+    // Box `item` was registered with (a segment's padded bounding box)
+    const sf::FloatRect& box(uint32_t item) const { return bounds[item]; }
+
+    // Items whose cell contains p, in insertion order
+    const std::vector<uint32_t>& at(sf::Vector2f p) const {
+        return cells[size_t(row(p.y)) * columns + column(p.x)];
+    }
+
+    // Items whose bounding box overlaps rect, each once, in no particular order
+    std::vector<uint32_t> in_rect(sf::FloatRect rect) {
+        std::vector<uint32_t> found;
+        query_stamp++;
+        int x0 = column(rect.position.x), x1 = column(rect.position.x + rect.size.x);
+        int y0 = row(rect.position.y), y1 = row(rect.position.y + rect.size.y);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                for (uint32_t item : cells[size_t(y) * columns + x]) {
+                    if (stamp[item] == query_stamp) continue;
+                    stamp[item] = query_stamp;
+                    if (overlaps(bounds[item], rect)) found.push_back(item);
+                }
+            }
+        }
+        return found;
+    }
+
+   private:
+    int columns = 1, rows = 1;
+    std::vector<std::vector<uint32_t>> cells;  // kept across frames for their capacity
+    std::vector<sf::FloatRect> bounds;
+    std::vector<uint32_t> stamp;
+    uint32_t query_stamp = 0;
+
+    int column(float x) const { return std::clamp(int(std::floor(x / cell_size)), 0, columns - 1); }
+    int row(float y) const { return std::clamp(int(std::floor(y / cell_size)), 0, rows - 1); }
+
+    void add(uint32_t item, int x, int y) {
+        auto& cell = cells[size_t(y) * columns + x];
+        if (cell.empty() || cell.back() != item) cell.push_back(item);
+    }
+
+    static bool overlaps(const sf::FloatRect& a, const sf::FloatRect& b) {
+        return a.position.x <= b.position.x + b.size.x && b.position.x <= a.position.x + a.size.x &&
+               a.position.y <= b.position.y + b.size.y && b.position.y <= a.position.y + a.size.y;
+    }
+};
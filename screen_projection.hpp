@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <SFML/Graphics.hpp>
+#include <sfml-3d/3d_camera.hpp>
+#include <sfml-3d/3d_engine.hpp>
+#include <sfml-3d/math4.hpp>
+
+
+/*
+The projection Object3D uses for its shapes, computed once per frame so the
+renderer can place things on screen without building a Shape2D for each of
+them: world -> camera space through the inverse camera frame, then
+Object3D::convert_3d_to_2d, offset to the middle of the window.
+*/
+struct ScreenProjection {
+    // Anything closer than this (camera-space z) is treated as behind the eye
+    static constexpr float NEAR_Z = 0.01f;
+
+    const Camera& camera;
+    mat4 view;
+    sf::Vector2f centre;
+
+    ScreenProjection(const Camera& camera, const sf::RenderTarget& target)
+        : camera(camera),
+          view(camera.cf.inverse_rigid()),
+          centre(sf::Vector2f(target.getSize()) * 0.5f) {}
+
+    vec4 to_camera(const vec4& world) const { return view * world; }
+
+    static bool in_front(const vec4& c) { return c.z > NEAR_Z; }
+
+    // c must be in front of the camera
+    sf::Vector2f to_screen(const vec4& c) const {
+        return centre + Object3D::convert_3d_to_2d(c, camera);
+    }
+
+    float radius_on_screen(float radius, const vec4& c) const {
+        return camera.FOV * radius / c.z;
+    }
+
+    // Whether a camera-space sphere touches the view frustum (between the
+    // near plane and the four planes through the eye and the window edges)
+    bool sphere_in_view(const vec4& c, float radius) const {
+        if (c.z + radius <= NEAR_Z) return false;
+        const float f = camera.FOV;
+        //Side plane x * f = z * centre.x, at distance (f|x| - centre.x z) / |(f, centre.x)|
+        if (f * std::abs(c.x) - centre.x * c.z > radius * std::sqrt(f * f + centre.x * centre.x)) return false;
+        if (f * std::abs(c.y) - centre.y * c.z > radius * std::sqrt(f * f + centre.y * centre.y)) return false;
+        return true;
+    }
+
+    // Liang-Barsky: cuts the screen segment a-b to the window grown by
+    // `margin`. False if none of it is inside.
+    bool clip_to_window(sf::Vector2f& a, sf::Vector2f& b, float margin) const {
+        const float lo_x = -margin, lo_y = -margin;
+        const float hi_x = 2 * centre.x + margin, hi_y = 2 * centre.y + margin;
+        const float dx = b.x - a.x, dy = b.y - a.y;
+        float t0 = 0, t1 = 1;
+
+        const float p[4] = {-dx, dx, -dy, dy};
+        const float q[4] = {a.x - lo_x, hi_x - a.x, a.y - lo_y, hi_y - a.y};
+        for (int k = 0; k < 4; k++) {
+            if (p[k] == 0) {
+                if (q[k] < 0) return false;
+                continue;
+            }
+            float t = q[k] / p[k];
+            if (p[k] < 0) t0 = std::max(t0, t);
+            else t1 = std::min(t1, t);
+            if (t0 > t1) return false;
+        }
+
+        sf::Vector2f start = a + sf::Vector2f(dx, dy) * t0;
+        b = a + sf::Vector2f(dx, dy) * t1;
+        a = start;
+        return true;
+    }
+
+    // Cuts the camera-space segment a-b at the near plane. False if all of it
+    // is behind the camera.
+    static bool clip_to_near(vec4& a, vec4& b) {
+        bool a_in = in_front(a), b_in = in_front(b);
+        if (a_in && b_in) return true;
+        if (!a_in && !b_in) return false;
+
+        float t = (NEAR_Z - a.z) / (b.z - a.z);
+        vec4 cut = a + (b - a) * t;
+        cut.z = NEAR_Z * 1.0001f;
+        (a_in ? b : a) = cut;
+        return true;
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "physics.hpp"
+
+
+/*
+Single-producer/single-consumer triple buffer.
+
+The writer fills back() and publish()es it; the reader calls update() to grab
+the most recently published buffer and then reads front(). Neither side ever
+waits for the other: the three slots are swapped through one atomic byte
+holding the index of the spare slot plus a "fresh" bit.
+*/
+template <class T>
+struct TripleBuffer {
+    T& back() { return buffers[back_index]; }
+    const T& front() const { return buffers[front_index]; }
+
+    void publish() {
+        uint8_t previous = spare.exchange(back_index | FRESH, std::memory_order_acq_rel);
+        back_index = previous & INDEX;
+    }
+
+    // True if a newer buffer was published since the last call
+    bool update() {
+        if (!(spare.load(std::memory_order_acquire) & FRESH)) return false;
+        uint8_t previous = spare.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & INDEX;
+        return true;
+    }
+
+   private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    T buffers[3];
+    std::atomic<uint8_t> spare{1};
+    uint8_t back_index = 0;
+    uint8_t front_index = 2;
+};
+
+
+struct SimSnapshot {
+    uint64_t version = 0;  // commands applied before these positions were taken
+    std::vector<float> px, py, pz;
+
+    float energy = 0;
+    size_t awake = 0;
+    bool idle = false;
+};
+
+
+/*
+Runs a Simulation on its own thread, independent of the render frame rate.
+The thread wakes tick_rate times per second and advances the simulation by
+the wall-clock time since the last tick; Simulation::advance turns that into
+fixed-size steps.
+
+Edits are posted as commands and applied by the simulation thread between
+steps, in posting order. Every snapshot carries the number of commands that
+had been applied, so the owner can ignore positions that predate its latest
+edit (their node ids may no longer line up). While paused, or once the layout
+has gone idle, the thread blocks until the next command or unpause.
+*/
+struct SimulationThread {
+    using Command = std::function<void(Simulation&)>;
+
+    explicit SimulationThread(Simulation initial, double tick_rate = 60.0)
+        : sim(std::move(initial)),
+          tick_period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(1.0 / tick_rate))) {
+        thread = std::thread([this] { loop(); });
+    }
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    ~SimulationThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    // Called from the owning thread only
+    void post(Command command) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            commands.push_back(std::move(command));
+        }
+        posted_count++;
+        wake.notify_one();
+    }
+
+    uint64_t posted() const { return posted_count; }
+
+    void set_paused(bool value) {
+        if (paused == value) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            paused = value;
+        }
+        wake.notify_one();
+    }
+
+    // Latest snapshot, or nullptr if nothing new was published since the
+    // last call
+    const SimSnapshot* poll() {
+        return snapshots.update() ? &snapshots.front() : nullptr;
+    }
+
+   private:
+    Simulation sim;
+    std::chrono::steady_clock::duration tick_period;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Command> commands;
+    bool stopping = false;
+    std::atomic<bool> paused{true};  // written under mutex so waits see it
+
+    uint64_t posted_count = 0;   // owner side
+    uint64_t applied_count = 0;  // simulation side
+
+    TripleBuffer<SimSnapshot> snapshots;
+
+    void publish() {
+        SimSnapshot& snapshot = snapshots.back();
+        snapshot.version = applied_count;
+        snapshot.px.assign(sim.px.begin(), sim.px.end());
+        snapshot.py.assign(sim.py.begin(), sim.py.end());
+        snapshot.pz.assign(sim.pz.begin(), sim.pz.end());
+        snapshot.energy = sim.energy();
+        snapshot.awake = sim.awake_count();
+        snapshot.idle = sim.idle;
+        snapshots.publish();
+    }
+
+    void loop() {
+        using clock = std::chrono::steady_clock;
+        std::vector<Command> pending;
+        auto last_tick = clock::now();
+        auto next_tick = last_tick + tick_period;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (paused || sim.idle) {
+                    //Nothing to integrate: sleep until an edit or unpause
+                    wake.wait(lock, [this] {
+                        return stopping || !commands.empty() || (!paused && !sim.idle);
+                    });
+                    last_tick = clock::now();
+                    next_tick = last_tick + tick_period;
+                } else {
+                    wake.wait_until(lock, next_tick, [this] { return stopping || !commands.empty(); });
+                }
+                if (stopping) return;
+                pending.swap(commands);
+            }
+
+            for (auto& command : pending) command(sim);
+            applied_count += pending.size();
+            bool changed = !pending.empty();
+            pending.clear();
+
+            auto now = clock::now();
+            if (!paused && !sim.idle && now >= next_tick) {
+                changed |= sim.advance(std::chrono::duration<float>(now - last_tick).count()) > 0;
+                last_tick = now;
+
+                next_tick += tick_period;
+                if (next_tick < now) next_tick = now + tick_period;
+            }
+
+            if (changed) publish();
+        }
+    }
+};
@@ -0,0 +1,71 @@
+// An edit whose journal record starts a compaction has to be in the model
+// that compaction saves: once the save is written the record is dropped, and
+// after a crash the edit is nowhere else. With every edit starting a
+// compaction, a rename of a connected node and a connection removal must
+// both be there on reloading without a save.
+
+#undef NDEBUG
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+
+#include <SFML/Graphics.hpp>
+#include <sfml-3d/3d_camera.hpp>
+#include <sfml-3d/3d_engine.hpp>
+#include <sfml-3d/math4.hpp>
+
+#include "3d_mm.hpp"
+
+namespace fs = std::filesystem;
+
+
+void test_edits_survive_compaction(Camera& camera) {
+    std::cout << "Testing Journal Compaction..." << std::endl;
+
+    const std::string dir = (fs::temp_directory_path() / "mm_journal_compaction_test").string();
+    fs::remove_all(dir);
+
+    MM base;
+    for (std::string title : {"A", "B", "C"}) base.nodes[title] = "Body of " + title;
+    base.connect("A", "B");
+    base.connect("B", "C");
+    {
+        Physical_MM pmm(base, camera);
+        pmm.save(dir);
+    }
+
+    {
+        Physical_MM pmm(dir, camera);
+        pmm.journal_compact_bytes = 1;
+
+        pmm.changeNodeTitle("A", "Renamed");
+        pmm.finishCompaction();
+        assert(pmm.journal->size_bytes() == 0);  // compacted, record dropped
+
+        pmm.removeConnection("B", "C");
+        pmm.finishCompaction();
+        assert(pmm.journal->size_bytes() == 0);
+
+        //Not saved: only the compactions hold the edits now
+    }
+
+    Physical_MM reloaded(dir, camera);
+    assert(reloaded.mm.nodes.contains("Renamed"));
+    assert(!reloaded.mm.nodes.contains("A"));
+    assert(reloaded.mm.connections.size() == 1);
+    assert(reloaded.mm.find_connection("Renamed", "B") != -1);
+    assert(reloaded.mm.find_connection("B", "C") == -1);
+    reloaded.validityCheck();
+
+    fs::remove_all(dir);
+    std::cout << "Journal Compaction Passed!" << std::endl;
+}
+
+
+int main() {
+    sf::RenderWindow window(sf::VideoMode({800, 600}), "journal_compaction_test");
+    Camera camera(window, 60.0f, 0.001f, 2.f, 10.f, 0.5f);
+
+    test_edits_survive_compaction(camera);
+    return 0;
+}
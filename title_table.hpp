@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/*
+Node titles interned to small integer ids, so that MM::connections can refer
+to nodes by id: 8 bytes per connection, integer comparisons, and renaming a
+node is one table update however many connections it has. An id stays with
+its node through renames; ids of released titles are reused.
+*/
+struct TitleTable {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Id of `title`, giving it the next free one if it has none yet
+    uint32_t intern(const std::string& title) {
+        auto [it, added] = ids.try_emplace(title, NONE);
+        if (!added) return it->second;
+
+        if (free_ids.empty()) {
+            it->second = titles.size();
+            titles.push_back(title);
+        } else {
+            it->second = free_ids.back();
+            free_ids.pop_back();
+            titles[it->second] = title;
+        }
+        return it->second;
+    }
+
+    // NONE if `title` has no id
+    uint32_t find(const std::string& title) const {
+        auto it = ids.find(title);
+        return it == ids.end() ? NONE : it->second;
+    }
+
+    const std::string& operator[](uint32_t id) const {
+        assert(id < titles.size());
+        return titles[id];
+    }
+
+    void rename(uint32_t id, const std::string& title) {
+        assert(id < titles.size() && !ids.contains(title));
+        ids.erase(titles[id]);
+        ids.emplace(title, id);
+        titles[id] = title;
+    }
+
+    // Nothing may refer to `id` any more
+    void release(uint32_t id) {
+        assert(id < titles.size());
+        ids.erase(titles[id]);
+        titles[id].clear();
+        free_ids.push_back(id);
+    }
+
+    // Ids in use
+    size_t size() const { return ids.size(); }
+
+    // Every id is below this
+    size_t id_limit() const { return titles.size(); }
+
+    void reserve(size_t count) {
+        titles.reserve(count);
+        ids.reserve(count);
+    }
+
+   private:
+    std::vector<std::string> titles;  // by id; empty if free
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<uint32_t> free_ids;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/*
+Fixed-size pool of worker threads for fork/join style loops.
+
+run(job) calls job(t) once for every t in [0, size()) and returns when all of
+them are done. The calling thread takes t = 0 itself, so a pool of size 1 has
+no threads at all and simply runs the job inline. Which thread runs which t is
+fixed, so work split by t (and anything reduced in t order afterwards) is
+deterministic.
+*/
+struct WorkerPool {
+    explicit WorkerPool(size_t thread_count) {
+        for (size_t t = 1; t < thread_count; t++) {
+            workers.emplace_back([this, t] { worker_loop(t); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t size() const { return workers.size() + 1; }
+
+    void run(const std::function<void(size_t)>& job) {
+        if (workers.empty()) {
+            job(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            pending = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        job(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        current = nullptr;
+    }
+
+    // [begin, end) of the t-th of `parts` near-equal chunks of [0, count)
+    static std::pair<size_t, size_t> chunk(size_t count, size_t parts, size_t t) {
+        size_t base = count / parts;
+        size_t extra = count % parts;
+        size_t begin = t * base + std::min(t, extra);
+        return {begin, begin + base + (t < extra ? 1 : 0)};
+    }
+
+   private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t)>* current = nullptr;
+    size_t pending = 0;
+    size_t generation = 0;
+    bool stopping = false;
+
+    void worker_loop(size_t t) {
+        size_t seen = 0;
+        while (true) {
+            const std::function<void(size_t)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                job = current;
+            }
+
+            (*job)(t);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+};